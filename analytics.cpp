@@ -0,0 +1,384 @@
+#include "analytics.h"
+#include "board.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+void RoundStats::clear()
+{
+  for(int i = 0; i < MAX_PLAYERS; ++i)
+  {
+    turns[i] = 0;
+    kills[i] = 0;
+    suicides[i] = 0;
+    crashes[i] = 0;
+    deathFrame[i] = -1;
+  }
+}
+
+void RoundStats::onRoundFinished()
+{
+  next->onRoundFinished();
+}
+
+void RoundStats::onKilled(int frameCount, int victim, int killer)
+{
+  if(victim == killer)
+    suicides[victim - 1]++;
+  else
+    kills[killer - 1]++;
+
+  deathFrame[victim - 1] = frameCount;
+  next->onKilled(frameCount, victim, killer);
+}
+
+void RoundStats::onCrash(int frameCount, vector<int> victims)
+{
+  for(auto victim : victims)
+  {
+    crashes[victim]++;
+    deathFrame[victim] = frameCount;
+  }
+
+  next->onCrash(frameCount, victims);
+}
+
+void RoundStats::onTurn(int frameCount, int bike)
+{
+  turns[bike - 1]++;
+  next->onTurn(frameCount, bike);
+}
+
+namespace
+{
+// File layout (native endianness): blocks, one after the other, each made
+// of a BlockHeader and its payload, padded to 8 bytes.
+//
+// rounds block: 'count' rounds, column by column:
+//   length: count * int32
+//   then for each metric, for each bike: count * int32
+// heatmap block: over 'count' rounds:
+//   width * height * uint32
+//
+// Blocks are only ever appended: the file can hold several sessions.
+const char MAGIC[4] = { 'L', 'R', 'A', 'N' };
+
+enum BlockType
+{
+  BLOCK_ROUNDS = 1,
+  BLOCK_HEATMAP = 2,
+};
+
+struct BlockHeader
+{
+  char magic[4];
+  uint32_t type;
+  uint32_t count;
+  int32_t width, height;
+  uint32_t reserved;
+  uint64_t size; // of the payload
+};
+
+// Rounds kept in memory before being written, as one block.
+auto const ROUNDS_PER_BLOCK = 4096;
+
+// Adds the occupancy of the board to the heatmap, one chunk row at a time.
+void accumulate(Board const& board, uint32_t* heat)
+{
+  for(int cy = 0; cy < board.chunksY; ++cy)
+  {
+    for(int cx = 0; cx < board.chunksX; ++cx)
+    {
+      auto chunk = board.getChunk(cx, cy);
+
+      if(!chunk)
+        continue;
+
+      int x0 = cx * Board::CHUNK_SIZE;
+      int y0 = cy * Board::CHUNK_SIZE;
+      int w = min((int)Board::CHUNK_SIZE, board.width - x0);
+      int h = min((int)Board::CHUNK_SIZE, board.height - y0);
+
+      for(int row = 0; row < h; ++row)
+      {
+        auto src = (const uint8_t*)&chunk->cells[row * Board::CHUNK_SIZE];
+        auto dst = heat + (int64_t)(y0 + row) * board.width + x0;
+
+        // branchless, so that it vectorizes
+        for(int i = 0; i < w; ++i)
+          dst[i] += src[i] != 0;
+      }
+    }
+  }
+}
+
+struct AnalyticsWriter : IAnalyticsWriter
+{
+  AnalyticsWriter(const char* path)
+  {
+    fp = fopen(path, "ab");
+
+    if(!fp)
+      throw runtime_error(string("Can't open analytics file for writing: '") + path + "'");
+  }
+
+  ~AnalyticsWriter()
+  {
+    flushRounds();
+
+    for(auto& entry : heatmaps)
+    {
+      auto& heatmap = entry.second;
+      writeBlock(BLOCK_HEATMAP, heatmap.roundCount, entry.first.first, entry.first.second,
+                 heatmap.counts.data(), heatmap.counts.size() * sizeof(uint32_t));
+    }
+
+    fclose(fp);
+
+    printf("[analytics] %d rounds recorded\n", totalRounds);
+  }
+
+  void writeRound(IGame& game, RoundStats const& stats) override
+  {
+    auto& board = game.getBoard();
+    auto bikes = game.getBikes();
+
+    lock_guard<mutex> lock(m_mutex);
+
+    if(roundCount > 0 && (board.width != width || board.height != height))
+      flushRounds();
+
+    width = board.width;
+    height = board.height;
+
+    length.push_back(game.getFrameCount());
+
+    for(int i = 0; i < MAX_PLAYERS; ++i)
+    {
+      int lifetime = stats.deathFrame[i] >= 0 ? stats.deathFrame[i] : game.getFrameCount();
+      column(Metric::Lifetime, i).push_back(lifetime);
+      column(Metric::Turns, i).push_back(stats.turns[i]);
+      column(Metric::Kills, i).push_back(stats.kills[i]);
+      column(Metric::Suicides, i).push_back(stats.suicides[i]);
+      column(Metric::Crashes, i).push_back(stats.crashes[i]);
+      column(Metric::Cells, i).push_back(game.getTrailLength(1 + i));
+      column(Metric::Won, i).push_back(bikes[i].alive);
+    }
+
+    auto& heatmap = heatmaps[{ width, height }];
+    heatmap.counts.resize((size_t)width * height);
+    heatmap.roundCount++;
+    accumulate(board, heatmap.counts.data());
+
+    roundCount++;
+    totalRounds++;
+
+    if(roundCount == ROUNDS_PER_BLOCK)
+      flushRounds();
+  }
+
+  vector<int32_t>& column(Metric metric, int bike)
+  {
+    return columns[(int)metric][bike];
+  }
+
+  void flushRounds()
+  {
+    if(roundCount == 0)
+      return;
+
+    vector<int32_t> payload = length;
+
+    for(auto& metric : columns)
+      for(auto& values : metric)
+        payload.insert(payload.end(), values.begin(), values.end());
+
+    writeBlock(BLOCK_ROUNDS, roundCount, width, height, payload.data(), payload.size() * sizeof(int32_t));
+    fflush(fp);
+
+    length.clear();
+
+    for(auto& metric : columns)
+      for(auto& values : metric)
+        values.clear();
+
+    roundCount = 0;
+  }
+
+  void writeBlock(int type, int count, int blockWidth, int blockHeight, const void* payload, uint64_t size)
+  {
+    static const uint8_t zeroes[8] {};
+
+    BlockHeader header {};
+    memcpy(header.magic, MAGIC, sizeof MAGIC);
+    header.type = type;
+    header.count = count;
+    header.width = blockWidth;
+    header.height = blockHeight;
+    header.size = (size + 7) / 8 * 8;
+
+    bool ok = fwrite(&header, sizeof header, 1, fp) == 1;
+    ok &= fwrite(payload, 1, size, fp) == size;
+    ok &= fwrite(zeroes, 1, header.size - size, fp) == header.size - size;
+
+    if(!ok && !failed)
+    {
+      fprintf(stderr, "[analytics] can't write the file\n");
+      failed = true;
+    }
+  }
+
+  struct Heatmap
+  {
+    int roundCount = 0;
+    vector<uint32_t> counts;
+  };
+
+  FILE* fp;
+  bool failed = false;
+  mutex m_mutex;
+  int totalRounds = 0;
+  map<pair<int, int>, Heatmap> heatmaps; // by arena size
+
+  // the rounds of the next block
+  int roundCount = 0;
+  int width = 0, height = 0;
+  vector<int32_t> length;
+  vector<int32_t> columns[METRIC_COUNT][MAX_PLAYERS];
+};
+
+struct AnalyticsFile : IAnalyticsFile
+{
+  AnalyticsFile(const char* path)
+  {
+    int fd = open(path, O_RDONLY);
+
+    if(fd < 0)
+      throw runtime_error(string("Can't open analytics file: '") + path + "'");
+
+    struct stat st;
+    fstat(fd, &st);
+    size = st.st_size;
+
+    if(size > 0)
+      base = (const uint8_t*)mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if(base == MAP_FAILED)
+      throw runtime_error(string("Can't map analytics file: '") + path + "'");
+
+    uint64_t offset = 0;
+
+    while(size - offset >= sizeof(BlockHeader))
+    {
+      auto header = (BlockHeader const*)(base + offset);
+
+      if(memcmp(header->magic, MAGIC, sizeof MAGIC))
+      {
+        unmap();
+        throw runtime_error(string("Not an analytics file: '") + path + "'");
+      }
+
+      auto payload = offset + sizeof(BlockHeader);
+
+      if(header->size > size - payload)
+        break; // cut short
+
+      if(header->type == BLOCK_ROUNDS && header->size >= (uint64_t)header->count * (1 + METRIC_COUNT * MAX_PLAYERS) * sizeof(int32_t))
+        rounds.push_back(header);
+
+      if(header->type == BLOCK_HEATMAP && header->size >= (uint64_t)header->width * header->height * sizeof(uint32_t))
+        heatmaps.push_back(header);
+
+      offset = payload + header->size;
+    }
+  }
+
+  ~AnalyticsFile()
+  {
+    unmap();
+  }
+
+  void unmap()
+  {
+    if(base && base != MAP_FAILED)
+      munmap((void*)base, size);
+
+    base = nullptr;
+  }
+
+  int blockCount() override
+  {
+    return rounds.size();
+  }
+
+  AnalyticsBlock block(int i) override
+  {
+    auto header = rounds.at(i);
+    auto values = (const int32_t*)(header + 1);
+
+    AnalyticsBlock r;
+    r.roundCount = header->count;
+    r.width = header->width;
+    r.height = header->height;
+    r.length = values;
+    values += header->count;
+
+    for(auto& metric : r.columns)
+    {
+      for(auto& column : metric)
+      {
+        column = values;
+        values += header->count;
+      }
+    }
+
+    return r;
+  }
+
+  int heatmapCount() override
+  {
+    return heatmaps.size();
+  }
+
+  AnalyticsHeatmap heatmap(int i) override
+  {
+    auto header = heatmaps.at(i);
+
+    AnalyticsHeatmap r;
+    r.roundCount = header->count;
+    r.width = header->width;
+    r.height = header->height;
+    r.counts = (const uint32_t*)(header + 1);
+    return r;
+  }
+
+  const uint8_t* base = nullptr;
+  uint64_t size = 0;
+  vector<BlockHeader const*> rounds;
+  vector<BlockHeader const*> heatmaps;
+};
+}
+
+unique_ptr<IAnalyticsWriter> createAnalyticsWriter(const char* path)
+{
+  return make_unique<AnalyticsWriter>(path);
+}
+
+unique_ptr<IAnalyticsFile> openAnalyticsFile(const char* path)
+{
+  return make_unique<AnalyticsFile>(path);
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include "game.h"
+
+// Balance analytics: per-round, per-bike metrics, appended to a columnar
+// file, plus board occupancy heatmaps accumulated over the rounds.
+
+enum class Metric
+{
+  Lifetime, // turns survived
+  Turns, // direction changes
+  Kills,
+  Suicides,
+  Crashes, // into obstacles or other bikes
+  Cells, // trail length at the end of the round
+  Won, // 1 if alive at the end of the round
+};
+
+static auto const METRIC_COUNT = 7;
+
+// Counts the events of a round, and passes them on to 'next'.
+struct RoundStats : IEventSink
+{
+  RoundStats(IEventSink* next_ = &nullSink) : next(next_)
+  {
+    clear();
+  }
+
+  void clear();
+
+  void onRoundFinished() override;
+  void onKilled(int frameCount, int victim, int killer) override;
+  void onCrash(int frameCount, vector<int> victims) override;
+  void onTurn(int frameCount, int bike) override;
+
+  IEventSink* next;
+  int turns[MAX_PLAYERS];
+  int kills[MAX_PLAYERS];
+  int suicides[MAX_PLAYERS];
+  int crashes[MAX_PLAYERS];
+  int deathFrame[MAX_PLAYERS]; // -1 while alive
+};
+
+struct IAnalyticsWriter
+{
+  virtual ~IAnalyticsWriter() = default;
+
+  // Records a finished round of 'game', whose events went to 'stats'.
+  // Can be called from several threads.
+  virtual void writeRound(IGame& game, RoundStats const& stats) = 0;
+};
+
+// Appends to the file (creating it if needed). Rounds are written by
+// blocks; the rest of them, and the heatmaps, once the writer is destroyed.
+std::unique_ptr<IAnalyticsWriter> createAnalyticsWriter(const char* path);
+
+// A block of rounds of the same arena size, stored column by column.
+struct AnalyticsBlock
+{
+  int roundCount;
+  int width, height;
+  const int32_t* length; // in turns, per round
+  const int32_t* columns[METRIC_COUNT][MAX_PLAYERS]; // per round
+};
+
+// The occupancy counts of each cell: in how many rounds it was part of a
+// trail, at the end of the round.
+struct AnalyticsHeatmap
+{
+  int roundCount;
+  int width, height;
+  const uint32_t* counts; // width * height, row by row
+};
+
+struct IAnalyticsFile
+{
+  virtual ~IAnalyticsFile() = default;
+
+  virtual int blockCount() = 0;
+  virtual AnalyticsBlock block(int i) = 0;
+
+  // one per arena size and writing session
+  virtual int heatmapCount() = 0;
+  virtual AnalyticsHeatmap heatmap(int i) = 0;
+};
+
+// Maps the file in memory: the columns are used in place.
+// Throws if it isn't an analytics file. A block cut short (e.g the
+// writer was killed) ends the file.
+std::unique_ptr<IAnalyticsFile> openAnalyticsFile(const char* path);
@@ -0,0 +1,349 @@
+#include "archive.h"
+#include "board.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace
+{
+// Archive layout (native endianness):
+//
+// header: ArchiveHeader, rewritten once the archive is complete
+// rounds, one after the other:
+//   inputs: turnCount * MAX_PLAYERS bytes (see packInput)
+//   keyframes: game states (IGame::saveState)
+//   keyframe index: keyframeCount * ArchiveKeyframe
+// round index: roundCount * ArchiveRound
+//
+// The indices are 8-byte aligned, and are used in place once mapped.
+const char MAGIC[4] = { 'L', 'R', 'R', 'A' };
+const int VERSION = 3; // 2: speeds, swept moves, 3: turn phase in the keyframes
+
+struct ArchiveHeader
+{
+  char magic[4];
+  uint32_t version;
+  uint32_t roundCount;
+  uint32_t reserved;
+  uint64_t roundsOffset;
+};
+
+struct ArchiveRound
+{
+  int32_t width, height;
+  int32_t speed, boostSpeed;
+  int32_t turnCount;
+  int32_t keyframeCount;
+  uint64_t inputsOffset;
+  uint64_t keyframesOffset; // of the keyframe index
+};
+
+struct ArchiveKeyframe
+{
+  int32_t turn;
+  uint32_t size;
+  uint64_t offset;
+};
+
+uint8_t packInput(PlayerInput in)
+{
+  return in.left << 0 | in.right << 1 | in.up << 2 | in.down << 3 | in.boost << 4;
+}
+
+PlayerInput unpackInput(uint8_t val)
+{
+  PlayerInput in {};
+  in.left = val & 1;
+  in.right = val & 2;
+  in.up = val & 4;
+  in.down = val & 8;
+  in.boost = val & 16;
+  return in;
+}
+
+struct ReplayWriter : IReplayWriter
+{
+  ReplayWriter(const char* path, int keyframeInterval_) : keyframeInterval(keyframeInterval_)
+  {
+    fp = fopen(path, "wb");
+
+    if(!fp)
+      throw runtime_error(string("Can't open replay archive for writing: '") + path + "'");
+
+    ArchiveHeader header {};
+    write(&header, sizeof header);
+  }
+
+  ~ReplayWriter()
+  {
+    finishRound();
+    align();
+
+    ArchiveHeader header {};
+    memcpy(header.magic, MAGIC, sizeof MAGIC);
+    header.version = VERSION;
+    header.roundCount = rounds.size();
+    header.roundsOffset = offset;
+
+    write(rounds.data(), rounds.size() * sizeof(ArchiveRound));
+
+    fseek(fp, 0, SEEK_SET);
+    fwrite(&header, sizeof header, 1, fp);
+    fclose(fp);
+
+    printf("[replay] %d rounds archived\n", (int)rounds.size());
+  }
+
+  void onTurn(IGame& game, int frameCount, GameInput const& input) override
+  {
+    // a new round, or one joined midway
+    if(frameCount == 0 || frameCount != nextFrame)
+    {
+      finishRound();
+
+      round = {};
+      auto config = game.getConfig();
+      round.width = config.width;
+      round.height = config.height;
+      round.speed = config.speed;
+      round.boostSpeed = config.boostSpeed;
+      roundIsActive = true;
+    }
+
+    nextFrame = frameCount + 1;
+
+    if(round.turnCount % keyframeInterval == 0)
+    {
+      ArchiveKeyframe keyframe {};
+      keyframe.turn = round.turnCount;
+      keyframe.offset = states.size();
+      game.saveState(states);
+      keyframe.size = states.size() - keyframe.offset;
+      keyframes.push_back(keyframe);
+    }
+
+    for(auto& player : input.players)
+      inputs.push_back(packInput(player));
+
+    round.turnCount++;
+  }
+
+  void finishRound()
+  {
+    if(!roundIsActive)
+      return;
+
+    round.inputsOffset = offset;
+    write(inputs.data(), inputs.size());
+
+    auto statesOffset = offset;
+    write(states.data(), states.size());
+
+    for(auto& keyframe : keyframes)
+      keyframe.offset += statesOffset;
+
+    align();
+    round.keyframesOffset = offset;
+    round.keyframeCount = keyframes.size();
+    write(keyframes.data(), keyframes.size() * sizeof(ArchiveKeyframe));
+
+    rounds.push_back(round);
+
+    inputs.clear();
+    states.clear();
+    keyframes.clear();
+    roundIsActive = false;
+  }
+
+  void write(const void* data, size_t size)
+  {
+    if(fwrite(data, 1, size, fp) != size && !failed)
+    {
+      fprintf(stderr, "[replay] can't write the archive\n");
+      failed = true;
+    }
+
+    offset += size;
+  }
+
+  void align()
+  {
+    static const uint8_t zeroes[8] {};
+    write(zeroes, (8 - offset % 8) % 8);
+  }
+
+  const int keyframeInterval;
+  FILE* fp;
+  bool failed = false;
+  uint64_t offset = 0;
+  vector<ArchiveRound> rounds;
+
+  // the round being recorded
+  bool roundIsActive = false;
+  int nextFrame = -1;
+  ArchiveRound round {};
+  vector<uint8_t> inputs;
+  vector<uint8_t> states;
+  vector<ArchiveKeyframe> keyframes;
+};
+
+struct ReplayArchive : IReplayArchive
+{
+  ReplayArchive(const char* path)
+  {
+    int fd = open(path, O_RDONLY);
+
+    if(fd < 0)
+      throw runtime_error(string("Can't open replay archive: '") + path + "'");
+
+    struct stat st;
+    fstat(fd, &st);
+    size = st.st_size;
+
+    if(size > 0)
+      base = (const uint8_t*)mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if(base == MAP_FAILED)
+      throw runtime_error(string("Can't map replay archive: '") + path + "'");
+
+    try
+    {
+      auto header = at<ArchiveHeader>(0, 1);
+
+      if(memcmp(header->magic, MAGIC, sizeof MAGIC) || header->version != VERSION)
+        throw runtime_error(string("Not a replay archive, or an incomplete one: '") + path + "'");
+
+      rounds = at<ArchiveRound>(header->roundsOffset, header->roundCount);
+      count = header->roundCount;
+    }
+    catch(...)
+    {
+      unmap();
+      throw;
+    }
+  }
+
+  ~ReplayArchive()
+  {
+    unmap();
+  }
+
+  void unmap()
+  {
+    if(base && base != MAP_FAILED)
+      munmap((void*)base, size);
+
+    base = nullptr;
+  }
+
+  int roundCount() override
+  {
+    return count;
+  }
+
+  GameConfig roundConfig(int i) override
+  {
+    GameConfig config;
+    config.width = getRound(i).width;
+    config.height = getRound(i).height;
+    config.speed = getRound(i).speed;
+    config.boostSpeed = getRound(i).boostSpeed;
+    return config;
+  }
+
+  int turnCount(int i) override
+  {
+    return getRound(i).turnCount;
+  }
+
+  int keyframeCount(int i) override
+  {
+    return getRound(i).keyframeCount;
+  }
+
+  GameInput input(int i, int turn) override
+  {
+    auto& round = getRound(i);
+
+    if(turn < 0 || turn >= round.turnCount)
+      throw runtime_error("Replay turn out of range");
+
+    auto packed = at<uint8_t>(round.inputsOffset + (uint64_t)turn * MAX_PLAYERS, MAX_PLAYERS);
+
+    GameInput in {};
+
+    for(int k = 0; k < MAX_PLAYERS; ++k)
+      in.players[k] = unpackInput(packed[k]);
+
+    return in;
+  }
+
+  void seek(IGame& game, int i, int turn) override
+  {
+    auto& round = getRound(i);
+
+    if(turn < 0 || turn > round.turnCount)
+      throw runtime_error("Replay turn out of range");
+
+    auto keyframes = at<ArchiveKeyframe>(round.keyframesOffset, round.keyframeCount);
+
+    // the last keyframe at or before 'turn'
+    auto keyframe = upper_bound(keyframes, keyframes + round.keyframeCount, turn,
+                                [] (int t, ArchiveKeyframe const& k) { return t < k.turn; }) - 1;
+
+    if(keyframe < keyframes)
+      throw runtime_error("Replay round has no keyframe");
+
+    game.loadState(at<uint8_t>(keyframe->offset, keyframe->size), keyframe->size);
+
+    for(int t = keyframe->turn; t < turn; ++t)
+      game.oneTurn(input(i, t));
+  }
+
+  ArchiveRound const& getRound(int i)
+  {
+    if(i < 0 || i >= count)
+      throw runtime_error("Replay round out of range");
+
+    return rounds[i];
+  }
+
+  // 'n' items of type T at 'offset', within the file
+  template<typename T>
+  const T* at(uint64_t offset, uint64_t n)
+  {
+    if(offset > size || n * sizeof(T) > size - offset)
+      throw runtime_error("Corrupted replay archive");
+
+    return (const T*)(base + offset);
+  }
+
+  const uint8_t* base = nullptr;
+  uint64_t size = 0;
+  ArchiveRound const* rounds = nullptr;
+  int count = 0;
+};
+}
+
+unique_ptr<IReplayWriter> createReplayWriter(const char* path, int keyframeInterval)
+{
+  return make_unique<ReplayWriter>(path, keyframeInterval);
+}
+
+unique_ptr<IReplayArchive> openReplayArchive(const char* path)
+{
+  return make_unique<ReplayArchive>(path);
+}
+
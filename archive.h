@@ -0,0 +1,38 @@
+#pragma once
+
+#include <memory>
+#include "game.h"
+
+// Replay archives: many rounds in one file, each stored as its per-turn
+// inputs, plus a full-state keyframe every few turns.
+// Seeking to a turn restores the keyframe before it, and only replays the
+// turns in between.
+
+// Records every round the game plays (see IGame::setTurnListener).
+// The archive is complete once the writer is destroyed.
+struct IReplayWriter : ITurnListener
+{
+  virtual ~IReplayWriter() = default;
+};
+
+std::unique_ptr<IReplayWriter> createReplayWriter(const char* path, int keyframeInterval = 256);
+
+struct IReplayArchive
+{
+  virtual ~IReplayArchive() = default;
+
+  virtual int roundCount() = 0;
+  virtual GameConfig roundConfig(int round) = 0; // arena size
+  virtual int turnCount(int round) = 0;
+  virtual int keyframeCount(int round) = 0;
+  virtual GameInput input(int round, int turn) = 0;
+
+  // Brings 'game' (created with roundConfig(round)) to the state it had
+  // just before playing 'turn', in [0, turnCount(round)].
+  virtual void seek(IGame& game, int round, int turn) = 0;
+};
+
+// Maps the archive in memory: opening costs nothing, whatever its size.
+// Throws if the file isn't a replay archive.
+std::unique_ptr<IReplayArchive> openReplayArchive(const char* path);
+
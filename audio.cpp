@@ -1,99 +1,253 @@
 #include "audio.h"
+#include "synth.h"
 #include "assert.h"
 
 #include "SDL.h"
-#include <stdexcept>
-#include <string>
+#include <atomic>
+#include <cmath>
+#include <thread>
 
 namespace
 {
+  // Sounds further ahead than this are too far in the future: the game
+  // clock went faster than the audio one (e.g in turbo mode).
+  auto const MAX_AHEAD_SAMPLES = Synth::SAMPLE_RATE / 10;
+
+  struct SoundEvent
+  {
+    double time; // game time
+    Sound sound;
+  };
+
   struct Audio : IAudio
   {
-    Audio()
+    // Opening the device can take a while (e.g waking up a sound server):
+    // it's done in the background, and the sounds before are lost. The
+    // subsystem itself is initialized here, as SDL's init isn't thread-safe.
+    Audio(AudioConfig config_) : config(config_)
+    {
+      if(SDL_InitSubSystem(SDL_INIT_AUDIO))
+      {
+        printf("[audio] can't initialize audio: %s\n", SDL_GetError());
+        return;
+      }
+
+      m_initialized = true;
+      m_opener = std::thread(&Audio::open, this);
+    }
+
+    ~Audio()
+    {
+      if(!m_initialized)
+        return;
+
+      m_opener.join();
+
+      if(m_opened)
+        SDL_CloseAudioDevice(m_device);
+
+      SDL_QuitSubSystem(SDL_INIT_AUDIO);
+    }
+
+    void open()
     {
       SDL_AudioSpec spec {};
-      spec.freq = 48000;
+      spec.freq = Synth::SAMPLE_RATE;
       spec.channels = 1;
       spec.format = AUDIO_F32;
-      spec.samples = 1024;
+      spec.samples = config.bufferFrames;
       spec.callback = &Audio::staticMixAudio;
       spec.userdata = this;
 
+      // no changes allowed: SDL converts to the device if needed
       SDL_AudioSpec realSpec {};
-      if(SDL_OpenAudio(&spec, &realSpec))
-        throw std::runtime_error(std::string("Can't open audio: ") + SDL_GetError());
+      m_device = SDL_OpenAudioDevice(nullptr, 0, &spec, &realSpec, 0);
 
-      printf("[audio] %d Hz\n", realSpec.freq);
+      if(!m_device)
+      {
+        printf("[audio] can't open audio: %s\n", SDL_GetError());
+        return;
+      }
+
+      printf("[audio] %d Hz, %d samples per callback (%.1f ms)\n", realSpec.freq, realSpec.samples, realSpec.samples * 1000.0 / realSpec.freq);
       assert(realSpec.format == AUDIO_F32);
 
-      SDL_PauseAudio(0);
+      m_bufferFrames = realSpec.samples;
+      SDL_PauseAudioDevice(m_device, 0);
+      m_opened = true;
     }
 
-    ~Audio()
+    void play(Sound sound, double time) override
     {
-      SDL_CloseAudio();
+      if(!m_opened)
+        return;
+
+      // single producer, single consumer: when the callback falls behind
+      // that much, the sound is dropped
+      auto head = m_head.load(std::memory_order_relaxed);
+
+      if(head - m_tail.load(std::memory_order_acquire) == QUEUE_SIZE)
+        return;
+
+      m_queue[head % QUEUE_SIZE] = { time, sound };
+      m_head.store(head + 1, std::memory_order_release);
     }
 
-    void beep() override
+    AudioStats getStats() override
     {
-      m_env = 1.0;
+      AudioStats stats;
+      stats.callbackCount = m_callbackCount.load(std::memory_order_relaxed);
+      stats.callbackTime = m_callbackTime.load(std::memory_order_relaxed) / (double)SDL_GetPerformanceFrequency();
+      stats.underrunCount = m_underrunCount.load(std::memory_order_relaxed);
+      stats.lateSoundCount = m_lateSoundCount.load(std::memory_order_relaxed);
+      stats.bufferFrames = m_opened ? m_bufferFrames : 0;
+      return stats;
     }
 
     static void staticMixAudio(void* user, Uint8* samples, int len)
     {
       auto pThis = (Audio*)user;
-      pThis->mixAudio((float*)samples, len/sizeof(float));
+      auto start = SDL_GetPerformanceCounter();
+      pThis->mixAudio((float*)samples, len/sizeof(float), start);
+      pThis->m_callbackTime.fetch_add(SDL_GetPerformanceCounter() - start, std::memory_order_relaxed);
+      pThis->m_callbackCount.fetch_add(1, std::memory_order_relaxed);
     }
 
-    void mixAudio(float* samples, int sampleCount)
+    // Audio thread.
+    void mixAudio(float* samples, int sampleCount, uint64_t now)
     {
-      for(int i=0;i < sampleCount;++i)
-      {
-        m_lfophase += 10.0 / 48000.0;
-        if(m_lfophase > 1.0)
-          m_lfophase -= 1.0;
+      // the device holds about two blocks: a longer gap means it ran dry
+      if(m_lastCallback && now - m_lastCallback > 2.0 * sampleCount * SDL_GetPerformanceFrequency() / Synth::SAMPLE_RATE)
+        m_underrunCount.fetch_add(1, std::memory_order_relaxed);
 
-        auto freq = m_sineFreq + mySin(m_lfophase) * 20;
+      m_lastCallback = now;
 
-        m_phase1 += freq / 48000.0;
-        if(m_phase1 > 1.0)
-          m_phase1 -= 1.0;
+      auto blockStart = m_sampleClock;
+      auto blockEnd = blockStart + sampleCount;
+      receiveSounds(blockStart, sampleCount);
 
-        m_phase2 += freq * 1.5 / 48000.0;
-        if(m_phase2 > 1.0)
-          m_phase2 -= 1.0;
+      // the block is split at the start of each sound
+      int pos = 0;
 
-        m_env *= 0.9999;
+      while(m_pendingCount > 0 && m_pending[0].sample < blockEnd)
+      {
+        auto offset = int(m_pending[0].sample - blockStart);
+        m_synth.mixAudio(samples + pos, offset - pos);
+        pos = offset;
 
-        double osc = 0.0;
+        trigger(m_pending[0].sound);
 
-        osc += mySquare(m_phase1);
-        osc += mySquare(m_phase2);
+        for(int i = 1; i < m_pendingCount; ++i)
+          m_pending[i - 1] = m_pending[i];
 
-        samples[i] = osc * m_env * 0.3;
+        m_pendingCount--;
       }
+
+      m_synth.mixAudio(samples + pos, sampleCount - pos);
+      m_sampleClock = blockEnd;
     }
 
-    static double mySin(double t)
+    // Converts the game times of the new sounds into sample times: the
+    // offset between the two clocks is set by the first sound, so that it
+    // starts one block later, and kept as long as the clocks don't drift
+    // apart. That block of delay absorbs the jitter of the game thread: the
+    // sounds of a burst of ticks aren't late.
+    // In turbo mode, game time runs far ahead of the samples: each sound
+    // syncs the clocks again, and plays a block later.
+    void receiveSounds(int64_t blockStart, int sampleCount)
     {
-      return sin(t * 2 * M_PI);
+      auto tail = m_tail.load(std::memory_order_relaxed);
+      auto head = m_head.load(std::memory_order_acquire);
+
+      for(; tail != head; ++tail)
+      {
+        auto event = m_queue[tail % QUEUE_SIZE];
+        auto sample = (int64_t)llround(event.time * Synth::SAMPLE_RATE) + m_clockOffset;
+
+        if(!m_synced || sample < blockStart - sampleCount || sample > blockStart + MAX_AHEAD_SAMPLES)
+        {
+          m_clockOffset = blockStart + sampleCount - (int64_t)llround(event.time * Synth::SAMPLE_RATE);
+          m_synced = true;
+          sample = blockStart + sampleCount;
+        }
+
+        if(sample < blockStart)
+        {
+          m_lateSoundCount.fetch_add(1, std::memory_order_relaxed);
+          sample = blockStart;
+        }
+
+        if(m_pendingCount == MAX_PENDING)
+          continue;
+
+        // kept sorted: sounds come in order, but their times can step back
+        // when the clocks are synced again
+        int i = m_pendingCount++;
+
+        while(i > 0 && m_pending[i - 1].sample > sample)
+        {
+          m_pending[i] = m_pending[i - 1];
+          --i;
+        }
+
+        m_pending[i] = { sample, event.sound };
+      }
+
+      m_tail.store(tail, std::memory_order_release);
     }
 
-    static double mySquare(double t)
+    void trigger(Sound sound)
     {
-      return t < 0.5 ? -1 : 1;
+      switch(sound)
+      {
+      case Sound::Beep:
+        m_synth.beep();
+        break;
+      case Sound::Turn:
+        m_synth.beep(880.0, 0.999);
+        break;
+      case Sound::Crash:
+        m_synth.beep(110.0, 0.99995);
+        break;
+      }
     }
 
-    double m_phase1 = 0;
-    double m_phase2 = 0;
-    double m_lfophase = 0;
-    double m_sineFreq = 440.0;
-    double m_env = 0;
+    const AudioConfig config;
+    Synth m_synth;
+    std::atomic<uint64_t> m_callbackCount { 0 };
+    std::atomic<uint64_t> m_callbackTime { 0 }; // in performance counter ticks
+    std::atomic<uint64_t> m_underrunCount { 0 };
+    std::atomic<uint64_t> m_lateSoundCount { 0 };
+    bool m_initialized = false;
+    std::thread m_opener;
+    SDL_AudioDeviceID m_device = 0;
+    std::atomic<bool> m_opened { false };
+    int m_bufferFrames = 0;
+
+    // from the game thread to the audio thread
+    static auto const QUEUE_SIZE = 256;
+    SoundEvent m_queue[QUEUE_SIZE];
+    std::atomic<uint32_t> m_head { 0 };
+    std::atomic<uint32_t> m_tail { 0 };
+
+    // audio thread only
+    struct PendingSound
+    {
+      int64_t sample;
+      Sound sound;
+    };
+
+    static auto const MAX_PENDING = 64;
+    PendingSound m_pending[MAX_PENDING];
+    int m_pendingCount = 0;
+    int64_t m_sampleClock = 0; // samples mixed so far
+    int64_t m_clockOffset = 0; // from game time to sample time
+    bool m_synced = false;
+    uint64_t m_lastCallback = 0;
   };
 }
 
-std::unique_ptr<IAudio> createAudio()
+std::unique_ptr<IAudio> createAudio(AudioConfig config)
 {
-  return std::make_unique<Audio>();
+  return std::make_unique<Audio>(config);
 }
-
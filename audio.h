@@ -1,10 +1,49 @@
 #pragma once
 
+#include <cstdint>
 #include <memory>
+
+struct AudioStats
+{
+  uint64_t callbackCount;
+  double callbackTime; // in seconds, in total
+  uint64_t underrunCount; // callbacks so late that the device ran dry
+  uint64_t lateSoundCount; // sounds played after their time
+  int bufferFrames; // per callback, as opened
+};
+
+enum class Sound
+{
+  Beep, // new scene
+  Turn,
+  Crash,
+};
+
+struct AudioConfig
+{
+  // Samples per callback (a power of two), i.e the output latency: 1024 is
+  // about 21 ms. Low-latency setups can go down to 128 or 256, if the
+  // machine keeps up (see the underruns).
+  int bufferFrames = 1024;
+};
+
 struct IAudio
 {
   virtual ~IAudio() = default;
-  virtual void beep() = 0;
+
+  // Plays 'sound' at 'time', in seconds of game time (e.g the tick of the
+  // turn that caused it). The sounds keep the spacing of their times, to
+  // the sample, rather than all starting at the next callback.
+  virtual void play(Sound sound, double time) = 0;
+
+  // Since the device was opened. Can be called while it plays.
+  virtual AudioStats getStats() = 0;
+};
+
+struct NullAudio : IAudio
+{
+  void play(Sound, double) override {};
+  AudioStats getStats() override { return {}; };
 };
 
-std::unique_ptr<IAudio> createAudio();
+std::unique_ptr<IAudio> createAudio(AudioConfig config = AudioConfig());
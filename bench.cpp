@@ -0,0 +1,546 @@
+// Benchmark suite: times the hot paths of the game, without SDL.
+// Usage: bench.exe [--compare <baseline>] [--tolerance <ratio>] [--filter <prefix>]
+//
+// Prints one line per benchmark: '<name> <nanoseconds per operation> <noise>'.
+// The same format is read back as a baseline: with --compare, each result
+// is checked against it, and the exit status is 1 if one got slower than
+// the baseline by more than the tolerance (default: 0.15, i.e 15%).
+// Benchmarks whose runs spread by more than half the tolerance, now or in
+// the baseline, can't tell a regression apart from noise: they're reported,
+// but not checked.
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+#include "board.h"
+#include "bot.h"
+#include "game.h"
+#include "obstacles.h"
+#include "synth.h"
+#include "terminal.h"
+#include "trails.h"
+
+using namespace std;
+
+namespace
+{
+// Each benchmark runs for at least this long, this many times: the median
+// run is kept. The noise is the spread of the runs around it, leaving out
+// the fastest and the slowest, relative to the median.
+auto const MIN_RUN_TIME = chrono::milliseconds(100);
+auto const RUN_COUNT = 7;
+
+// A round lasts about a thousand turns: its beginning is timed over the
+// turns before LATE_ROUND_TURN, its end after.
+auto const TIMED_TURNS = 50;
+auto const LATE_ROUND_TURN = 500;
+
+struct Stopwatch
+{
+  void start()
+  {
+    begin = chrono::steady_clock::now();
+  }
+
+  void stop()
+  {
+    elapsed += chrono::steady_clock::now() - begin;
+  }
+
+  chrono::steady_clock::time_point begin;
+  chrono::steady_clock::duration elapsed {};
+};
+
+// 'body' times its work with the stopwatch, and returns the number of
+// operations it did.
+using Benchmark = function<int64_t(Stopwatch&)>;
+
+struct Measure
+{
+  double ns; // per operation
+  double noise;
+};
+
+Measure measure(Benchmark const& body)
+{
+  double runs[RUN_COUNT];
+
+  for(auto& ns : runs)
+  {
+    Stopwatch sw;
+    int64_t ops = 0;
+
+    while(sw.elapsed < MIN_RUN_TIME)
+      ops += body(sw);
+
+    ns = chrono::duration<double, nano>(sw.elapsed).count() / max<int64_t>(ops, 1);
+  }
+
+  sort(begin(runs), end(runs));
+
+  Measure r;
+  r.ns = runs[RUN_COUNT / 2];
+  r.noise = (runs[RUN_COUNT - 2] - runs[1]) / r.ns;
+  return r;
+}
+
+// Deterministic players, for all the bikes: the rollout policy, with a
+// seeded generator. Keeps a round going for a while.
+struct Bot
+{
+  GameInput play(IGame& game)
+  {
+    GameInput input {};
+    auto bikes = game.getBikes();
+
+    for(int i = 0; i < MAX_PLAYERS; ++i)
+      if(bikes[i].alive)
+        input.players[i] = playRandomly(game, i, rng);
+
+    return input;
+  }
+
+  uint32_t rng = 1;
+};
+
+unique_ptr<IGame> newGame(unsigned seed, ITerminal* terminal = &nullTerminal, GameConfig config = GameConfig())
+{
+  config.seed = seed;
+  return createGame(terminal, &nullSink, &nullSpectator, config);
+}
+
+// Plays until 'turn', or until the round is over.
+// Returns false if the round ended first.
+bool playUntil(IGame& game, Bot& bot, int turn)
+{
+  for(int i = 0; i < turn; ++i)
+  {
+    if(game.isRoundOver())
+      return false;
+
+    game.oneTurn(bot.play(game));
+  }
+
+  return !game.isRoundOver();
+}
+
+// Returns the first game, from 'seed' on, whose round lasts past 'turn'.
+unique_ptr<IGame> gameAtTurn(int turn, unsigned& seed, Bot& bot, ITerminal* terminal = &nullTerminal)
+{
+  while(true)
+  {
+    auto game = newGame(seed++, terminal);
+
+    if(playUntil(*game, bot, turn))
+      return game;
+  }
+}
+
+// Times the turns of a round, from 'startTurn' to 'endTurn'.
+int64_t benchTurns(Stopwatch& sw, int startTurn, int endTurn)
+{
+  struct Phase
+  {
+    unique_ptr<IGame> game;
+    int turn = 0;
+    unsigned seed = 1;
+    Bot bot;
+  };
+
+  static map<int, Phase> phases;
+  auto& phase = phases[startTurn];
+
+  if(!phase.game || phase.game->isRoundOver() || phase.turn >= endTurn)
+  {
+    phase.game = gameAtTurn(startTurn, phase.seed, phase.bot);
+    phase.turn = startTurn;
+  }
+
+  int turns = 0;
+
+  for(; turns < TIMED_TURNS && !phase.game->isRoundOver(); ++turns)
+  {
+    auto input = phase.bot.play(*phase.game);
+    sw.start();
+    phase.game->oneTurn(input);
+    sw.stop();
+  }
+
+  phase.turn += turns;
+  return turns;
+}
+
+Benchmark benchCollisions(int width, int height, int obstacleCount)
+{
+  return [=] (Stopwatch& sw)
+         {
+           Obstacles obstacles(width, height);
+
+           for(int i = 0; i < obstacleCount; ++i)
+             obstacles.add({ { rand() % width, rand() % height }, { 0, 0 }, { rand() % 200 + 20, rand() % 200 + 20 }, true });
+
+           vector<int> jitter(obstacleCount * 4);
+           obstacles.move(jitter.data());
+
+           auto const QUERIES = 1000;
+           Vec2 queries[QUERIES];
+
+           for(auto& pos : queries)
+             pos = { rand() % width, rand() % height };
+
+           int hits = 0;
+           sw.start();
+
+           for(auto pos : queries)
+             hits += obstacles.hits(pos);
+
+           sw.stop();
+
+           // keep the loop from being optimized out
+           if(hits < 0)
+             printf("\n");
+
+           return QUERIES;
+         };
+}
+
+int64_t benchErase(Stopwatch& sw)
+{
+  static Board board(BOARD_WIDTH, BOARD_HEIGHT);
+  static Trails trails(BOARD_WIDTH, BOARD_HEIGHT);
+
+  auto const ERASES = 100;
+
+  for(int i = 0; i < ERASES; ++i)
+  {
+    // a trail across the rectangle, then the obstacle wipes it
+    Vec2 pos = { rand() % BOARD_WIDTH, rand() % BOARD_HEIGHT };
+
+    for(int k = 0; k < 200; ++k)
+    {
+      Vec2 cell = { (pos.x + k) % BOARD_WIDTH, (pos.y + 100) % BOARD_HEIGHT };
+      board.set(cell.x, cell.y, 1);
+      trails.onMove(1, cell, Direction::Right, 1);
+    }
+
+    sw.start();
+    board.eraseRectangle(pos.x, pos.y, 200, 200);
+    trails.erase(pos, { 200, 200 });
+    sw.stop();
+  }
+
+  return ERASES;
+}
+
+// The trails are repainted where a turn changed them.
+int64_t benchDraw(Stopwatch& sw)
+{
+  static Terminal terminal;
+  static Bot bot;
+  static unsigned seed = 1;
+  static auto game = gameAtTurn(LATE_ROUND_TURN, seed, bot, &terminal);
+
+  auto const FRAMES = 10;
+
+  for(int i = 0; i < FRAMES; ++i)
+  {
+    if(game->isRoundOver())
+      game = gameAtTurn(LATE_ROUND_TURN, seed, bot, &terminal);
+
+    game->oneTurn(bot.play(*game));
+    terminal.quads.clear();
+
+    sw.start();
+    game->draw((int*)terminal.pixels);
+    sw.stop();
+  }
+
+  return FRAMES;
+}
+
+// A wall-display arena: the screen scrolls on every turn, and is fully
+// repainted. Times either the turns (the obstacle erases) or the draws.
+Benchmark benchBigArena(int threadCount, bool timeDraws)
+{
+  struct State
+  {
+    Terminal terminal;
+    unique_ptr<IGame> game;
+    unsigned seed = 1;
+    Bot bot;
+  };
+
+  auto state = make_shared<State>();
+
+  return [=] (Stopwatch& sw)
+         {
+           auto& game = state->game;
+
+           if(!game || game->isRoundOver())
+           {
+             GameConfig config;
+             config.width = 4096;
+             config.height = 3072;
+             config.obstacleCount = 500;
+             config.threadCount = threadCount;
+             game = newGame(state->seed++, &state->terminal, config);
+           }
+
+           auto const FRAMES = 10;
+           int frames = 0;
+
+           for(; frames < FRAMES && !game->isRoundOver(); ++frames)
+           {
+             auto input = state->bot.play(*game);
+
+             if(!timeDraws)
+               sw.start();
+
+             game->oneTurn(input);
+
+             if(!timeDraws)
+               sw.stop();
+
+             state->terminal.quads.clear();
+
+             if(timeDraws)
+               sw.start();
+
+             game->draw((int*)state->terminal.pixels);
+
+             if(timeDraws)
+               sw.stop();
+           }
+
+           return frames;
+         };
+}
+
+int64_t benchDrawHead(Stopwatch& sw)
+{
+  static Terminal terminal;
+  auto const HEADS = 1000;
+
+  terminal.quads.clear();
+  sw.start();
+
+  for(int i = 0; i < HEADS; ++i)
+    terminal.drawHead({ i % BOARD_WIDTH, i % BOARD_HEIGHT }, 1 + i % MAX_PLAYERS);
+
+  sw.stop();
+
+  return HEADS;
+}
+
+int64_t benchDrawObstacle(Stopwatch& sw)
+{
+  static Terminal terminal;
+  auto const OBSTACLES = 10;
+
+  terminal.quads.clear();
+  sw.start();
+
+  for(int i = 0; i < OBSTACLES; ++i)
+    terminal.drawObstacle({ i * 97 % BOARD_WIDTH, i * 89 % BOARD_HEIGHT }, { 200, 200 });
+
+  sw.stop();
+
+  return OBSTACLES;
+}
+
+int64_t benchMixAudio(Stopwatch& sw)
+{
+  static Synth synth;
+  static float samples[1024];
+
+  synth.beep();
+
+  sw.start();
+  synth.mixAudio(samples, 1024);
+  sw.stop();
+
+  return 1;
+}
+
+int64_t benchRound(Stopwatch& sw)
+{
+  // the same game for all the rounds, as the game does
+  static auto game = newGame(1);
+
+  sw.start();
+
+  game->reset(1);
+  Bot bot;
+
+  while(!game->isRoundOver())
+    game->oneTurn(bot.play(*game));
+
+  sw.stop();
+
+  return 1;
+}
+
+// A rollout bot deciding in the middle of a round, on one thread: the
+// time of one rollout (of the default depth).
+int64_t benchRollouts(Stopwatch& sw)
+{
+  // bike 0 must be alive, or the bot has nothing to decide
+  static auto game = [] ()
+    {
+      Bot players;
+
+      for(unsigned seed = 1;; ++seed)
+      {
+        auto game = newGame(seed);
+
+        if(playUntil(*game, players, 200) && game->getBikes()[0].alive)
+          return game;
+      }
+    }();
+  static auto bot = [] ()
+    {
+      BotConfig config;
+      config.threadCount = 1;
+      return createRolloutBot(config);
+    }();
+
+  auto before = bot->getRolloutCount();
+
+  sw.start();
+  bot->play(*game, 0);
+  sw.stop();
+
+  return bot->getRolloutCount() - before;
+}
+
+struct Entry
+{
+  const char* name;
+  Benchmark body;
+};
+
+map<string, Measure> loadBaseline(const char* path)
+{
+  map<string, Measure> r;
+  auto fp = fopen(path, "r");
+
+  if(!fp)
+  {
+    fprintf(stderr, "Can't open baseline '%s'\n", path);
+    exit(1);
+  }
+
+  char line[512];
+
+  while(fgets(line, sizeof line, fp))
+  {
+    char name[256];
+    Measure m {};
+
+    if(sscanf(line, "%255s %lf %lf", name, &m.ns, &m.noise) >= 2)
+      r[name] = m;
+  }
+
+  fclose(fp);
+  return r;
+}
+}
+
+int main(int argc, char* argv[])
+{
+  const char* baselinePath = nullptr;
+  const char* filter = "";
+  double tolerance = 0.15;
+
+  for(int i = 1; i < argc; ++i)
+  {
+    string arg = argv[i];
+
+    if(arg == "--compare" && i + 1 < argc)
+      baselinePath = argv[++i];
+    else if(arg == "--tolerance" && i + 1 < argc)
+      tolerance = atof(argv[++i]);
+    else if(arg == "--filter" && i + 1 < argc)
+      filter = argv[++i];
+    else
+    {
+      fprintf(stderr, "Usage: %s [--compare <baseline>] [--tolerance <ratio>] [--filter <prefix>]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  map<string, Measure> baseline;
+
+  if(baselinePath)
+    baseline = loadBaseline(baselinePath);
+
+  Entry const entries[] =
+  {
+    { "turn.early", [] (Stopwatch& sw) { return benchTurns(sw, 0, LATE_ROUND_TURN); } },
+    { "turn.late", [] (Stopwatch& sw) { return benchTurns(sw, LATE_ROUND_TURN, INT_MAX); } },
+    { "collisions.3", benchCollisions(BOARD_WIDTH, BOARD_HEIGHT, 3) },
+    { "collisions.500", benchCollisions(8192, 8192, 500) },
+    { "erase.200x200", benchErase },
+    { "draw", benchDraw },
+    { "big.turn.1thread", benchBigArena(1, false) },
+    { "big.turn.threads", benchBigArena(0, false) },
+    { "big.draw.1thread", benchBigArena(1, true) },
+    { "big.draw.threads", benchBigArena(0, true) },
+    { "terminal.drawHead", benchDrawHead },
+    { "terminal.drawObstacle", benchDrawObstacle },
+    { "audio.mix1024", benchMixAudio },
+    { "round.headless", benchRound },
+    { "bot.rollout", benchRollouts },
+  };
+
+  int regressions = 0;
+
+  for(auto& entry : entries)
+  {
+    if(strncmp(entry.name, filter, strlen(filter)))
+      continue;
+
+    srand(1);
+    auto m = measure(entry.body);
+
+    if(!baselinePath)
+    {
+      printf("%s %.1f %.3f\n", entry.name, m.ns, m.noise);
+      fflush(stdout);
+      continue;
+    }
+
+    auto i = baseline.find(entry.name);
+
+    if(i == baseline.end())
+    {
+      printf("%s %.1f (no baseline)\n", entry.name, m.ns);
+      continue;
+    }
+
+    double ratio = m.ns / i->second.ns;
+    double noise = max(m.noise, i->second.noise);
+    bool noisy = noise > tolerance / 2;
+    bool regressed = !noisy && ratio > 1.0 + tolerance;
+    regressions += regressed;
+
+    printf("%s %.1f (baseline: %.1f, x%.2f, noise %.0f%%)%s\n", entry.name, m.ns, i->second.ns, ratio, noise * 100,
+           regressed ? " REGRESSION" : noisy ? " (too noisy, not checked)" : "");
+    fflush(stdout);
+  }
+
+  if(regressions)
+  {
+    fprintf(stderr, "%d benchmark(s) slower than the baseline by more than %.0f%%\n", regressions, tolerance * 100);
+    return 1;
+  }
+
+  return 0;
+}
+
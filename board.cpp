@@ -0,0 +1,265 @@
+#include "board.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+namespace
+{
+auto const MAX_SPARE_CHUNKS = 64;
+}
+
+Board::Board(int width_, int height_) :
+  width(width_),
+  height(height_),
+  chunksX((width_ + CHUNK_SIZE - 1) / CHUNK_SIZE),
+  chunksY((height_ + CHUNK_SIZE - 1) / CHUNK_SIZE)
+{
+  chunks.resize(chunksX * chunksY);
+}
+
+void Board::set(int x, int y, int value)
+{
+  auto& chunk = chunks[chunkIndex(x, y)];
+
+  if(!chunk || chunk->generation != generation)
+  {
+    if(!value)
+      return;
+
+    // reuse the memory of a stale chunk, if any
+    if(!chunk)
+      allocChunk(chunk);
+
+    memset(chunk->cells, 0, sizeof chunk->cells);
+    chunk->count = 0;
+    chunk->generation = generation;
+    chunk->hash = 0;
+  }
+
+  auto& cell = chunk->cells[cellIndex(x, y)];
+  chunk->count += (value != 0) - (cell != 0);
+
+  uint64_t change = 0;
+
+  if(cell)
+    change ^= cellKey(x, y, cell);
+
+  if(value)
+    change ^= cellKey(x, y, value);
+
+  chunk->hash ^= change;
+  cellsHash ^= change;
+
+  cell = value;
+
+  if(chunk->count == 0)
+    freeChunk(chunk);
+}
+
+void Board::readRow(int x, int y, int count, char* out) const
+{
+  while(count > 0)
+  {
+    int n = min(count, CHUNK_SIZE - (x & (CHUNK_SIZE - 1)));
+
+    if(auto chunk = liveChunk(chunkIndex(x, y)))
+      memcpy(out, &chunk->cells[cellIndex(x, y)], n);
+    else
+      memset(out, 0, n);
+
+    x += n;
+    out += n;
+    count -= n;
+  }
+}
+
+void Board::eraseRectangle(int x, int y, int w, int h)
+{
+  Rect rect { x, y, w, h };
+  eraseRectangles(&rect, 1);
+}
+
+void Board::eraseRectangles(Rect const* rects, int count, ThreadPool* pool)
+{
+  // a few stripes per thread, to even out the load
+  int stripeCount = pool ? min(chunksY, pool->size() * 4) : 1;
+
+  stripes.resize(stripeCount);
+
+  for(int i = 0; i < stripeCount; ++i)
+  {
+    auto& stripe = stripes[i];
+    stripe.begin = chunksY * i / stripeCount;
+    stripe.end = chunksY * (i + 1) / stripeCount;
+    stripe.hash = 0;
+    stripe.emptiedChunks.clear();
+  }
+
+  auto job = [&] (int i)
+    {
+      auto& stripe = stripes[i];
+
+      for(int k = 0; k < count; ++k)
+      {
+        auto r = rects[k];
+
+        if(r.w <= 0 || r.h <= 0)
+          continue;
+
+        int w = min(r.w, width);
+        int h = min(r.h, height);
+        int x = (r.x % width + width) % width;
+        int y = (r.y % height + height) % height;
+
+        // split at the board edges
+        int w1 = min(w, width - x);
+        int h1 = min(h, height - y);
+
+        eraseSpan(x, y, w1, h1, stripe);
+        eraseSpan(0, y, w - w1, h1, stripe);
+        eraseSpan(x, 0, w1, h - h1, stripe);
+        eraseSpan(0, 0, w - w1, h - h1, stripe);
+      }
+    };
+
+  if(pool)
+    pool->parallelFor(stripeCount, job);
+  else
+    job(0);
+
+  for(auto& stripe : stripes)
+  {
+    cellsHash ^= stripe.hash;
+
+    for(auto index : stripe.emptiedChunks)
+      freeChunk(chunks[index]);
+  }
+}
+
+// Erases the part of a rectangle that doesn't cross the board edges, and
+// lies within the stripe.
+// Chunks emptied here stay allocated, with a count of zero, until the
+// stripe is done.
+void Board::eraseSpan(int x, int y, int w, int h, Stripe& stripe)
+{
+  if(w <= 0 || h <= 0)
+    return;
+
+  int firstRow = max(y >> CHUNK_BITS, stripe.begin);
+  int lastRow = min((y + h - 1) >> CHUNK_BITS, stripe.end - 1);
+
+  for(int cy = firstRow; cy <= lastRow; ++cy)
+  {
+    for(int cx = x >> CHUNK_BITS; cx <= (x + w - 1) >> CHUNK_BITS; ++cx)
+    {
+      int index = cy * chunksX + cx;
+      auto chunk = liveChunk(index);
+
+      if(!chunk || chunk->count == 0)
+        continue;
+
+      // intersection of the rectangle with the chunk
+      int x0 = max(x, cx * CHUNK_SIZE);
+      int x1 = min(x + w, (cx + 1) * CHUNK_SIZE);
+      int y0 = max(y, cy * CHUNK_SIZE);
+      int y1 = min(y + h, (cy + 1) * CHUNK_SIZE);
+
+      if(x1 - x0 == CHUNK_SIZE && y1 - y0 == CHUNK_SIZE)
+      {
+        // its cells are cleared when it's reused
+        stripe.hash ^= chunk->hash;
+        chunk->hash = 0;
+        chunk->count = 0;
+        stripe.emptiedChunks.push_back(index);
+        continue;
+      }
+
+      for(int row = y0; row < y1; ++row)
+      {
+        auto cells = &chunk->cells[cellIndex(x0, row)];
+
+        for(int i = 0; i < x1 - x0; ++i)
+        {
+          if(cells[i])
+          {
+            auto key = cellKey(x0 + i, row, cells[i]);
+            chunk->hash ^= key;
+            stripe.hash ^= key;
+            chunk->count--;
+          }
+        }
+
+        memset(cells, 0, x1 - x0);
+      }
+
+      if(chunk->count == 0)
+        stripe.emptiedChunks.push_back(index);
+    }
+  }
+}
+
+void Board::clear()
+{
+  ++generation;
+  cellsHash = 0;
+}
+
+int Board::allocatedChunks() const
+{
+  int count = 0;
+
+  for(auto& chunk : chunks)
+    count += chunk != nullptr;
+
+  return count;
+}
+
+void Board::copyChunk(Board const& other, int index)
+{
+  auto src = other.liveChunk(index);
+  auto& chunk = chunks[index];
+
+  if(auto dst = liveChunk(index))
+    cellsHash ^= dst->hash;
+  else if(!src)
+    return; // empty on both sides
+
+  if(!src)
+  {
+    freeChunk(chunk);
+    return;
+  }
+
+  if(!chunk)
+    allocChunk(chunk);
+
+  memcpy(chunk->cells, src->cells, sizeof chunk->cells);
+  chunk->count = src->count;
+  chunk->generation = generation;
+  chunk->hash = src->hash;
+  cellsHash ^= src->hash;
+}
+
+void Board::allocChunk(unique_ptr<Chunk>& chunk)
+{
+  if(spareChunks.empty())
+  {
+    chunk = make_unique<Chunk>();
+  }
+  else
+  {
+    chunk = move(spareChunks.back());
+    spareChunks.pop_back();
+  }
+}
+
+void Board::freeChunk(unique_ptr<Chunk>& chunk)
+{
+  if(spareChunks.size() < MAX_SPARE_CHUNKS)
+    spareChunks.push_back(move(chunk));
+  else
+    chunk.reset();
+}
+
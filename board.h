@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+struct ThreadPool;
+
+// Sparse board of arbitrary size, made of square chunks.
+// A chunk is allocated on its first non-empty write, and freed once all
+// its cells have been erased: most of a big arena stays empty for most of
+// a round, and then costs nothing.
+// Coordinates are toroidal: they wrap around the board edges.
+// Clearing the board only bumps a generation counter: chunks written during
+// an older generation are stale, they read as empty, and are reused in
+// place on their next write.
+struct Board
+{
+  static auto const CHUNK_BITS = 6;
+  static auto const CHUNK_SIZE = 1 << CHUNK_BITS;
+
+  struct Chunk
+  {
+    char cells[CHUNK_SIZE * CHUNK_SIZE];
+    int count; // non-empty cells
+    unsigned generation;
+    uint64_t hash; // of its cells, see Board::hash
+  };
+
+  struct Rect
+  {
+    int x, y, w, h;
+  };
+
+  Board(int width, int height);
+
+  int get(int x, int y) const
+  {
+    auto chunk = liveChunk(chunkIndex(x, y));
+
+    if(!chunk)
+      return 0;
+
+    return chunk->cells[cellIndex(x, y)];
+  }
+
+  void set(int x, int y, int value);
+
+  // Copies 'count' cells of row 'y', starting at 'x', without wrapping.
+  void readRow(int x, int y, int count, char* out) const;
+
+  // Empties the cells of the rectangle (wrapping around the edges).
+  void eraseRectangle(int x, int y, int w, int h);
+
+  // Same as erasing the rectangles one by one. With a pool, the board is
+  // split into horizontal stripes of chunks, erased in parallel.
+  void eraseRectangles(Rect const* rects, int count, ThreadPool* pool = nullptr);
+
+  // O(1): the memory of the chunks is kept for the next round.
+  void clear();
+
+  // Returns null if all the cells of the chunk are empty.
+  Chunk const* getChunk(int chunkX, int chunkY) const
+  {
+    return liveChunk(chunkY * chunksX + chunkX);
+  }
+
+  int allocatedChunks() const;
+
+  // Makes chunk 'index' hold the same cells as the one of 'other', which
+  // must have the same size. O(chunk): restores the chunks a scratch game
+  // touched, without copying the whole board.
+  void copyChunk(Board const& other, int index);
+
+  // Zobrist-style hash of the cells: the XOR of the keys of all the
+  // non-empty cells. Kept up to date by every write, so it costs nothing
+  // to read.
+  uint64_t hash() const
+  {
+    return cellsHash;
+  }
+
+  static uint64_t cellKey(int x, int y, int value)
+  {
+    // splitmix64 finalizer
+    uint64_t z = (uint64_t)x | (uint64_t)y << 24 | (uint64_t)(uint8_t)value << 48;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+
+  static int cellIndex(int x, int y)
+  {
+    return (y & (CHUNK_SIZE - 1)) * CHUNK_SIZE + (x & (CHUNK_SIZE - 1));
+  }
+
+  const int width, height;
+  const int chunksX, chunksY;
+
+private:
+  int chunkIndex(int x, int y) const
+  {
+    return (y >> CHUNK_BITS) * chunksX + (x >> CHUNK_BITS);
+  }
+
+  Chunk* liveChunk(int index) const
+  {
+    auto chunk = chunks[index].get();
+
+    if(!chunk || chunk->generation != generation)
+      return nullptr;
+
+    return chunk;
+  }
+
+  // What an erase did to a stripe of chunk rows. The chunks it emptied
+  // are freed afterwards, on the calling thread.
+  struct Stripe
+  {
+    int begin, end; // chunk rows
+    uint64_t hash;
+    std::vector<int> emptiedChunks;
+  };
+
+  void eraseSpan(int x, int y, int w, int h, Stripe& stripe);
+  void allocChunk(std::unique_ptr<Chunk>& chunk);
+  void freeChunk(std::unique_ptr<Chunk>& chunk);
+
+  std::vector<std::unique_ptr<Chunk>> chunks;
+  unsigned generation = 0;
+  uint64_t cellsHash = 0;
+
+  // recently freed chunks, to avoid hitting the allocator when an obstacle
+  // moves over a trail.
+  std::vector<std::unique_ptr<Chunk>> spareChunks;
+
+  std::vector<Stripe> stripes;
+};
+
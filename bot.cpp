@@ -0,0 +1,246 @@
+#include "bot.h"
+#include "board.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <chrono>
+
+using namespace std;
+
+namespace
+{
+const int dirs[][2] =
+{
+  { 0, 0 },
+  { -1, 0 },
+  { 0, 1 },
+  { 1, 0 },
+  { 0, -1 },
+};
+
+PlayerInput toInput(Direction direction)
+{
+  PlayerInput input {};
+  input.left = direction == Direction::Left;
+  input.down = direction == Direction::Down;
+  input.right = direction == Direction::Right;
+  input.up = direction == Direction::Up;
+  return input;
+}
+
+bool isOpposed(Direction a, Direction b)
+{
+  return dirs[(int)a][0] == -dirs[(int)b][0] && dirs[(int)a][1] == -dirs[(int)b][1];
+}
+
+bool isFree(Board const& board, Vec2 pos, Direction direction)
+{
+  int x = (pos.x + dirs[(int)direction][0] + board.width) % board.width;
+  int y = (pos.y + dirs[(int)direction][1] + board.height) % board.height;
+  return board.get(x, y) == 0;
+}
+
+int random(uint32_t& rng)
+{
+  // xorshift32
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng & 0x7fffffff;
+}
+
+// What a worker learnt about each candidate direction.
+struct Tally
+{
+  int64_t rollouts;
+  int64_t survivals;
+  int64_t turns; // survived, in total
+};
+
+// Each worker plays its rollouts on its own scratch game, brought back to
+// the decision state after each one.
+struct Worker
+{
+  unique_ptr<IGame> game;
+  uint32_t rng;
+  Tally tallies[4];
+
+  // Returns the number of turns 'bike' survived, 'depth' if it still lives.
+  int rollout(int bike, Direction first, int depth)
+  {
+    int turn = 0;
+
+    for(; turn < depth; ++turn)
+    {
+      auto bikes = game->getBikes();
+
+      if(!bikes[bike].alive || game->isRoundOver())
+        break;
+
+      GameInput input {};
+
+      for(int i = 0; i < MAX_PLAYERS; ++i)
+        if(bikes[i].alive)
+          input.players[i] = turn == 0 && i == bike ? toInput(first) : playRandomly(*game, i, rng);
+
+      game->oneTurn(input);
+    }
+
+    if(game->getBikes()[bike].alive)
+      turn = depth;
+
+    game->rollback();
+    return turn;
+  }
+};
+
+struct RolloutBot : IBot
+{
+  RolloutBot(BotConfig config_) : config(config_), pool(config.threadCount)
+  {
+    workers.resize(pool.size());
+  }
+
+  PlayerInput play(IGame& game, int bike) override
+  {
+    auto current = game.getBikes()[bike];
+
+    if(!current.alive)
+      return {};
+
+    Direction candidates[4];
+    int candidateCount = 0;
+
+    for(int d = 1; d <= 4; ++d)
+      if(current.direction == Direction::Idle || !isOpposed(current.direction, (Direction)d))
+        candidates[candidateCount++] = (Direction)d;
+
+    prepareWorkers(game);
+
+    auto deadline = chrono::steady_clock::now() + chrono::microseconds(config.budgetUs);
+
+    auto job = [&] (int w)
+      {
+        auto& worker = workers[w];
+
+        worker.game->loadState(state.data(), state.size());
+        worker.game->checkpoint();
+
+        for(auto& tally : worker.tallies)
+          tally = {};
+
+        // each worker starts on another candidate: the tallies stay
+        // balanced, even when the budget only allows a few rollouts
+        for(int k = w; chrono::steady_clock::now() < deadline; ++k)
+        {
+          int c = k % candidateCount;
+          int turns = worker.rollout(bike, candidates[c], config.depth);
+          auto& tally = worker.tallies[c];
+          tally.rollouts++;
+          tally.survivals += turns == config.depth;
+          tally.turns += turns;
+        }
+      };
+
+    pool.parallelFor((int)workers.size(), job);
+
+    // the best survival rate, then the longest survival on average
+    Direction best = current.direction == Direction::Idle ? candidates[0] : current.direction;
+    double bestRate = -1;
+    double bestTurns = -1;
+
+    for(int c = 0; c < candidateCount; ++c)
+    {
+      Tally total {};
+
+      for(auto& worker : workers)
+      {
+        total.rollouts += worker.tallies[c].rollouts;
+        total.survivals += worker.tallies[c].survivals;
+        total.turns += worker.tallies[c].turns;
+      }
+
+      rolloutCount += total.rollouts;
+
+      if(!total.rollouts)
+        continue;
+
+      double rate = total.survivals / (double)total.rollouts;
+      double turns = total.turns / (double)total.rollouts;
+
+      if(rate > bestRate || (rate == bestRate && turns > bestTurns))
+      {
+        best = candidates[c];
+        bestRate = rate;
+        bestTurns = turns;
+      }
+    }
+
+    return toInput(best);
+  }
+
+  int64_t getRolloutCount() override
+  {
+    return rolloutCount;
+  }
+
+  // The scratch games follow the arena of the game played.
+  void prepareWorkers(IGame& game)
+  {
+    auto gameConfig = game.getConfig();
+    gameConfig.threadCount = 1; // the workers are the parallelism
+
+    for(int w = 0; w < (int)workers.size(); ++w)
+    {
+      auto& worker = workers[w];
+      auto current = worker.game ? worker.game->getConfig() : GameConfig();
+
+      if(!worker.game || current.width != gameConfig.width || current.height != gameConfig.height ||
+         current.speed != gameConfig.speed || current.boostSpeed != gameConfig.boostSpeed)
+      {
+        worker.game = createGame(&nullTerminal, &nullSink, &nullSpectator, gameConfig);
+        worker.rng = config.seed * 2654435761u + w * 40503u + 1;
+
+        if(!worker.rng)
+          worker.rng = 1;
+      }
+    }
+
+    state.clear();
+    game.saveState(state);
+  }
+
+  const BotConfig config;
+  ThreadPool pool;
+  vector<Worker> workers;
+  vector<uint8_t> state; // of the game, at the decision
+  int64_t rolloutCount = 0;
+};
+}
+
+PlayerInput playRandomly(IGame& game, int bike, uint32_t& rng)
+{
+  auto& board = game.getBoard();
+  auto& current = game.getBikes()[bike];
+  auto dir = current.direction;
+
+  if(dir != Direction::Idle && isFree(board, current.pos, dir) && random(rng) % 16)
+    return toInput(dir);
+
+  // try both sides, in random order
+  int side = random(rng) % 2 ? 1 : 3;
+
+  for(int k = 0; k < 2; ++k)
+  {
+    auto candidate = (Direction)(((int)dir - 1 + side + k * 2) % 4 + 1);
+
+    if(isFree(board, current.pos, candidate))
+      return toInput(candidate);
+  }
+
+  return toInput(dir);
+}
+
+unique_ptr<IBot> createRolloutBot(BotConfig config)
+{
+  return make_unique<RolloutBot>(config);
+}
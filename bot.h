@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include "game.h"
+
+// Computer players.
+
+struct BotConfig
+{
+  // time spent on each decision
+  int budgetUs = 1000;
+
+  // turns played by each rollout
+  int depth = 64;
+
+  // 0: one per core
+  int threadCount = 0;
+
+  unsigned seed = 0;
+};
+
+struct IBot
+{
+  virtual ~IBot() = default;
+
+  // The move of bike 'bike' (0-based) for the next turn of 'game'.
+  virtual PlayerInput play(IGame& game, int bike) = 0;
+
+  // Rollouts played since the bot was created.
+  virtual int64_t getRolloutCount() = 0;
+};
+
+// The policy of the rollouts, cheap: straight on, unless the next cell is
+// taken, and now and then a random turn. 'rng' is a xorshift32 state (not 0).
+PlayerInput playRandomly(IGame& game, int bike, uint32_t& rng);
+
+// Monte Carlo bot: for each direction it can take, plays many short random
+// rounds (rollouts) from the current state, on scratch copies of the game,
+// and picks the direction it survived the most often.
+std::unique_ptr<IBot> createRolloutBot(BotConfig config = BotConfig());
@@ -1,10 +1,15 @@
 #define GL_GLEXT_PROTOTYPES
 #include "display.h"
+#include "recorder.h"
 #include "SDL.h"
 #include "SDL_opengl.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cstddef>
+#include <cstdio>
 #include <string>
+#include <vector>
 
 using namespace std;
 
@@ -30,56 +35,123 @@ void ensureGl(char const* expr, int line)
   exit(1);
 }
 
-struct Vertex
-{
-  float x, y;
-  float u, v;
-};
-
-auto const vertex_shader = R"(#version 130
+// Post-process passes: one triangle covering the viewport. The shaders
+// address their inputs in texels, from gl_FragCoord.
+auto const pass_vertex_shader = R"(#version 130
 in vec2 pos;
-in vec2 vertexUV;
-
-out vec2 UV;
 
 void main()
 {
-  UV = vertexUV;
   gl_Position = vec4( pos, 0.0, 1.0 );
 }
 )";
 
-auto const fragment_shader = R"(#version 130
-in vec2 UV;
+// 2x2 box filter: each pass halves the resolution.
+auto const downsample_fragment_shader = R"(#version 130
+out vec4 color;
+uniform sampler2D source;
+
+void main()
+{
+  ivec2 last = textureSize(source, 0) - 1;
+  ivec2 p = ivec2(gl_FragCoord.xy) * 2;
+
+  color = 0.25 * (texelFetch(source, min(p, last), 0)
+                  + texelFetch(source, min(p + ivec2(1, 0), last), 0)
+                  + texelFetch(source, min(p + ivec2(0, 1), last), 0)
+                  + texelFetch(source, min(p + ivec2(1, 1), last), 0));
+}
+)";
 
+// One axis of a 9-tap gaussian, in 5 bilinear fetches.
+auto const blur_fragment_shader = R"(#version 130
 out vec4 color;
-uniform sampler2D diffuse;
+uniform sampler2D source;
+uniform vec2 direction; // one texel along the axis, in UV units
 
-const vec2 scale = vec2(0.001, 0.001);
+const float offsets[3] = float[3](0.0, 1.3846153846, 3.2307692308);
+const float weights[3] = float[3](0.2270270270, 0.3162162162, 0.0702702703);
 
-const vec2 myFilter[7] = vec2[7](
-	vec2(-3.0, 0.015),
-	vec2(-2.0, 0.053),
-	vec2(-1.0, 0.434),
-	vec2( 0.0, 0.912),
-	vec2( 1.0, 0.434),
-	vec2( 2.0, 0.053),
-	vec2( 3.0, 0.015)
-);
+void main()
+{
+  vec2 uv = gl_FragCoord.xy / vec2(textureSize(source, 0));
+  color = texture(source, uv) * weights[0];
+
+  for( int i = 1; i < 3; i++ )
+  {
+    color += texture(source, uv + direction * offsets[i]) * weights[i];
+    color += texture(source, uv - direction * offsets[i]) * weights[i];
+  }
+}
+)";
+
+// The frame, plus the glow.
+auto const composite_fragment_shader = R"(#version 130
+out vec4 color;
+uniform sampler2D frame;
+uniform sampler2D bloom;
 
 void main()
 {
-  color = vec4(0, 0, 0, 0);
+  vec2 size = vec2(textureSize(frame, 0));
+  color = texelFetch(frame, ivec2(gl_FragCoord.xy), 0) + texture(bloom, gl_FragCoord.xy / size);
+}
+)";
+
+// The mosaic atlas, top-down, at an integer zoom, centered in the window.
+auto const mosaic_fragment_shader = R"(#version 130
+out vec4 color;
+uniform sampler2D atlas;
+uniform ivec2 origin; // bottom-left corner of the atlas, in the window
+uniform int scale;
 
-  for( int i = 0; i < 7; i++ )
+void main()
+{
+  ivec2 size = textureSize(atlas, 0);
+  ivec2 pos = ivec2(gl_FragCoord.xy) - origin;
+
+  if(any(lessThan(pos, ivec2(0))) || any(greaterThanEqual(pos / scale, size)))
   {
-    vec2 pos = vec2( UV.x+myFilter[i].x*scale.x, UV.y+myFilter[i].x*scale.y);
-    color += texture2D(diffuse, pos )*myFilter[i].y;
+    color = vec4(0.0, 0.0, 0.0, 1.0);
+    return;
   }
+
+  pos /= scale;
+  color = texelFetch(atlas, ivec2(pos.x, size.y - 1 - pos.y), 0);
+}
+)";
+
+// Overlay: one instance per quad, positioned in frame pixels. It draws
+// into the frame texture, which is top-down like the pixels.
+auto const overlay_vertex_shader = R"(#version 130
+in vec2 corner;
+in vec4 rect;
+in vec4 quadColor;
+
+out vec4 color;
+uniform vec2 screenSize;
+
+void main()
+{
+  vec2 pos = (rect.xy + corner * rect.zw) / screenSize;
+  gl_Position = vec4( pos * 2.0 - 1.0, 0.0, 1.0 );
+  color = quadColor.bgra;
+}
+)";
+
+auto const overlay_fragment_shader = R"(#version 130
+in vec4 color;
+
+out vec4 fragColor;
+
+void main()
+{
+  fragColor = color;
 }
 )";
 
-enum { attrib_position, attrib_uv };
+enum { attrib_position };
+enum { attrib_corner, attrib_rect, attrib_color };
 
 int createShader(int type, const char* code)
 {
@@ -98,96 +170,728 @@ int createShader(int type, const char* code)
   return vs;
 }
 
-static const Vertex vertices[] =
+int createProgram(const char* vsCode, const char* fsCode, vector<const char*> attribs, bool retrievable = false)
 {
-  { -1, -1, 0, 0 },
-  { -1, +1, 0, -1 },
-  { +1, -1, 1, 0 },
+  auto program = glCreateProgram();
+  glAttachShader(program, createShader(GL_VERTEX_SHADER, vsCode));
+  glAttachShader(program, createShader(GL_FRAGMENT_SHADER, fsCode));
 
-  { -1, +1, 0, -1 },
-  { +1, +1, 1, -1 },
-  { +1, -1, 1, 0 },
-};
+  for(int i = 0; i < (int)attribs.size(); ++i)
+    SAFE_GL(glBindAttribLocation(program, i, attribs[i]));
 
-struct Display : IDisplay
+  if(retrievable)
+    SAFE_GL(glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE));
+
+  SAFE_GL(glLinkProgram(program));
+  return program;
+}
+
+uint64_t fnv1a(string const& s)
+{
+  uint64_t h = 0xcbf29ce484222325;
+
+  for(auto c : s)
+    h = (h ^ (uint8_t)c) * 0x100000001b3;
+
+  return h;
+}
+
+// Linked programs, kept on disk: the shaders are only compiled on the first
+// launch, and again after a driver update (the driver is part of the key).
+// Without a writable directory, or program binary formats, it compiles.
+struct ProgramCache
 {
-  Display(int width_, int height_) : width(width_), height(height_)
+  ProgramCache()
   {
-    SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
+    GLint formatCount = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+    glGetError(); // not an error: no cache
+
+    if(formatCount <= 0)
+      return;
 
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE | SDL_GL_CONTEXT_PROFILE_ES);
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 2);
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 0);
+    if(auto path = SDL_GetPrefPath("Ace17", "literace"))
+    {
+      dir = path;
+      SDL_free(path);
+    }
+
+    for(auto name : { GL_VENDOR, GL_RENDERER, GL_VERSION })
+      driver += (const char*)glGetString(name) + string("\n");
+  }
+
+  ~ProgramCache()
+  {
+    printf("[display] %d programs from the cache, %d compiled in %.1f ms\n",
+           loadCount, compileCount, compileTime * 1000.0 / SDL_GetPerformanceFrequency());
+  }
+
+  GLuint create(const char* vsCode, const char* fsCode, vector<const char*> attribs)
+  {
+    char name[64];
+    string key = driver + vsCode + fsCode;
 
-    m_window = SDL_CreateWindow("Literace", 0, 0, width, height, SDL_WINDOW_OPENGL);
-    assert(m_window);
+    for(auto attrib : attribs)
+      key += attrib + string("\n");
 
-    m_context = SDL_GL_CreateContext(m_window);
-    assert(m_context);
+    snprintf(name, sizeof name, "program-%016llx.bin", (unsigned long long)fnv1a(key));
+    auto path = dir + name;
 
-    GLuint vao;
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
+    if(!dir.empty())
+    {
+      if(auto program = load(path))
+      {
+        loadCount++;
+        return program;
+      }
+    }
 
-    auto vs = createShader(GL_VERTEX_SHADER, vertex_shader);
-    auto fs = createShader(GL_FRAGMENT_SHADER, fragment_shader);
+    auto start = SDL_GetPerformanceCounter();
+    auto program = createProgram(vsCode, fsCode, attribs, !dir.empty());
+    compileTime += SDL_GetPerformanceCounter() - start;
+    compileCount++;
+
+    if(!dir.empty())
+      save(program, path);
+
+    return program;
+  }
+
+  // Returns 0 if the file is missing, or rejected by the driver.
+  static GLuint load(string const& path)
+  {
+    auto fp = fopen(path.c_str(), "rb");
+
+    if(!fp)
+      return 0;
+
+    uint32_t format = 0;
+    vector<uint8_t> binary;
+    uint8_t buffer[4096];
+    bool ok = fread(&format, sizeof format, 1, fp) == 1;
+
+    while(auto n = fread(buffer, 1, sizeof buffer, fp))
+      binary.insert(binary.end(), buffer, buffer + n);
+
+    fclose(fp);
+
+    if(!ok || binary.empty())
+      return 0;
 
     auto program = glCreateProgram();
-    glAttachShader(program, vs);
-    glAttachShader(program, fs);
+    glProgramBinary(program, format, binary.data(), binary.size());
+    glGetError(); // a rejected binary isn't an error: the link status says it
 
-    SAFE_GL(glBindAttribLocation(program, attrib_position, "pos"));
-    SAFE_GL(glBindAttribLocation(program, attrib_uv, "vertexUV"));
-    SAFE_GL(glLinkProgram(program));
+    GLint status = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
 
-    SAFE_GL(glUseProgram(program));
+    if(!status)
+    {
+      glDeleteProgram(program);
+      return 0;
+    }
 
-    GLuint vbo;
-    SAFE_GL(glGenBuffers(1, &vbo));
-    SAFE_GL(glBindBuffer(GL_ARRAY_BUFFER, vbo));
+    return program;
+  }
 
-    GLuint texture;
-    SAFE_GL(glGenTextures(1, &texture));
-    SAFE_GL(glBindTexture(GL_TEXTURE_2D, texture));
-    SAFE_GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
-    SAFE_GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
-    SAFE_GL(glActiveTexture(GL_TEXTURE0));
+  // Written next to the final file, then renamed over it: a cabinet can
+  // be switched off at any time.
+  static void save(GLuint program, string const& path)
+  {
+    GLint size = 0;
+    SAFE_GL(glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size));
+
+    if(size <= 0)
+      return;
+
+    vector<uint8_t> binary(size);
+    GLenum format = 0;
+    SAFE_GL(glGetProgramBinary(program, size, nullptr, &format, binary.data()));
+
+    auto tmpPath = path + ".tmp";
+    auto fp = fopen(tmpPath.c_str(), "wb");
+
+    if(!fp)
+      return;
+
+    uint32_t format32 = format;
+    bool ok = fwrite(&format32, sizeof format32, 1, fp) == 1;
+    ok &= fwrite(binary.data(), 1, binary.size(), fp) == binary.size();
+    ok &= fclose(fp) == 0;
+
+    if(!ok || rename(tmpPath.c_str(), path.c_str()))
+      remove(tmpPath.c_str());
+  }
+
+  string dir; // empty: no caching
+  string driver;
+  int loadCount = 0;
+  int compileCount = 0;
+  Uint64 compileTime = 0;
+};
+
+static const float triangle[] = { -1, -1, 3, -1, -1, 3 };
+
+// A double-buffered window, and its GL context, made current.
+void openWindow(const char* title, int width, int height, bool fullscreen, SDL_Window*& window, SDL_GLContext& context)
+{
+  SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
+
+  SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE | SDL_GL_CONTEXT_PROFILE_ES);
+  SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 2);
+  SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 0);
+
+  Uint32 flags = SDL_WINDOW_OPENGL;
+
+  if(fullscreen)
+    flags |= SDL_WINDOW_FULLSCREEN_DESKTOP;
+
+  window = SDL_CreateWindow(title, 0, 0, width, height, flags);
+  assert(window);
+
+  context = SDL_GL_CreateContext(window);
+  assert(context);
+}
+
+// Creates the vertex array of the one-triangle passes.
+GLuint createPassVao()
+{
+  GLuint vao;
+  SAFE_GL(glGenVertexArrays(1, &vao));
+  SAFE_GL(glBindVertexArray(vao));
+
+  GLuint vbo;
+  SAFE_GL(glGenBuffers(1, &vbo));
+  SAFE_GL(glBindBuffer(GL_ARRAY_BUFFER, vbo));
+  SAFE_GL(glBufferData(GL_ARRAY_BUFFER, sizeof(triangle), triangle, GL_STATIC_DRAW));
+  SAFE_GL(glEnableVertexAttribArray(attrib_position));
+  SAFE_GL(glVertexAttribPointer(attrib_position, 2, GL_FLOAT, GL_FALSE, 0, nullptr));
+
+  return vao;
+}
+
+// A texture, and the framebuffer that renders to it.
+struct RenderTarget
+{
+  GLuint texture;
+  GLuint fbo;
+  int width, height;
+};
+
+RenderTarget createRenderTarget(int width, int height)
+{
+  RenderTarget target { 0, 0, width, height };
+
+  SAFE_GL(glGenTextures(1, &target.texture));
+  SAFE_GL(glBindTexture(GL_TEXTURE_2D, target.texture));
+  SAFE_GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+  SAFE_GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+  SAFE_GL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr));
+
+  SAFE_GL(glGenFramebuffers(1, &target.fbo));
+  SAFE_GL(glBindFramebuffer(GL_FRAMEBUFFER, target.fbo));
+  SAFE_GL(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target.texture, 0));
+  assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+  SAFE_GL(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+
+  return target;
+}
+
+// Reads back the presented frames asynchronously, through a ring of pixel
+// buffer objects. A buffer is only mapped once its fence is signaled, a few
+// frames later, so the render loop never waits for the GPU.
+struct FrameCapture
+{
+  static auto const RING_SIZE = 3;
+
+  FrameCapture(const char* dir, int x_, int y_, int width_, int height_) : x(x_), y(y_), width(width_), height(height_)
+  {
+    recorder = createRecorder(dir, width, height);
+
+    SAFE_GL(glGenBuffers(RING_SIZE, pbos));
+
+    for(auto pbo : pbos)
+    {
+      SAFE_GL(glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo));
+      SAFE_GL(glBufferData(GL_PIXEL_PACK_BUFFER, width * height * 4, nullptr, GL_STREAM_READ));
+    }
+
+    SAFE_GL(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+  }
+
+  ~FrameCapture()
+  {
+    collect(true);
+    glDeleteBuffers(RING_SIZE, pbos);
+  }
+
+  // Must be called after drawing, before swapping.
+  void capture()
+  {
+    collect(false);
+
+    if(pendingCount == RING_SIZE)
+      return; // the GPU is late, skip this frame rather than stall
+
+    int slot = (firstPending + pendingCount) % RING_SIZE;
+
+    SAFE_GL(glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[slot]));
+    SAFE_GL(glReadPixels(x, y, width, height, GL_BGRA, GL_UNSIGNED_BYTE, nullptr));
+    fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    SAFE_GL(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+
+    pendingCount++;
+  }
 
-#define OFFSET(a) \
-  ((GLvoid*)(&((Vertex*)nullptr)->a))
+  // Hands the completed read backs over to the recorder.
+  void collect(bool wait)
+  {
+    while(pendingCount > 0)
+    {
+      auto& fence = fences[firstPending];
+      auto status = glClientWaitSync(fence, 0, wait ? 1000000000 : 0);
+
+      if(status == GL_TIMEOUT_EXPIRED)
+        break;
+
+      glDeleteSync(fence);
+
+      SAFE_GL(glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[firstPending]));
+
+      if(auto data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, width * height * 4, GL_MAP_READ_BIT))
+      {
+        recorder->write((const uint8_t*)data);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+      }
+
+      SAFE_GL(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+
+      firstPending = (firstPending + 1) % RING_SIZE;
+      pendingCount--;
+    }
+  }
 
-    SAFE_GL(glEnableVertexAttribArray(attrib_position));
-    SAFE_GL(glVertexAttribPointer(attrib_position, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), OFFSET(x)));
-    SAFE_GL(glEnableVertexAttribArray(attrib_uv));
-    SAFE_GL(glVertexAttribPointer(attrib_uv, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), OFFSET(u)));
+  const int x, y, width, height;
+  unique_ptr<IRecorder> recorder;
+  GLuint pbos[RING_SIZE];
+  GLsync fences[RING_SIZE];
+  int firstPending = 0;
+  int pendingCount = 0;
+};
 
-    SAFE_GL(glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), &vertices, GL_STATIC_DRAW));
+struct Display : IDisplay
+{
+  Display(int width_, int height_, DisplayConfig config) : width(width_), height(height_)
+  {
+    openWindow("Literace", width * config.scale, height * config.scale, config.fullscreen, m_window, m_context);
+
+    // the largest integer zoom that fits, centered
+    SDL_GL_GetDrawableSize(m_window, &m_windowWidth, &m_windowHeight);
+    m_scale = max(1, min(m_windowWidth / width, m_windowHeight / height));
+    m_originX = (m_windowWidth - width * m_scale) / 2;
+    m_originY = (m_windowHeight - height * m_scale) / 2;
+
+    {
+      ProgramCache programs;
+      createPostProcess(config.postProcess, programs);
+      createOverlay(programs);
+    }
+
+    static const char* const qualityNames[] = { "off", "low", "high" };
+    printf("[display] %dx%d, x%d in a %dx%d window, post-process: %s\n",
+           width, height, m_scale, m_windowWidth, m_windowHeight, qualityNames[(int)config.postProcess]);
+  }
+
+  // Off: the frame only. Low: a glow blurred at 1/4 of the frame
+  // resolution. High: at 1/2. All the passes run at the frame resolution
+  // or below: the window only costs the final blit.
+  void createPostProcess(PostProcess quality, ProgramCache& programs)
+  {
+    m_vao = createPassVao();
+    m_frame = createRenderTarget(width, height);
+
+    if(quality == PostProcess::Off)
+    {
+      m_output = m_frame;
+      return;
+    }
+
+    m_output = createRenderTarget(width, height);
+
+    m_downsampleProgram = programs.create(pass_vertex_shader, downsample_fragment_shader, { "pos" });
+    m_blurProgram = programs.create(pass_vertex_shader, blur_fragment_shader, { "pos" });
+    m_blurDirection = glGetUniformLocation(m_blurProgram, "direction");
+
+    m_compositeProgram = programs.create(pass_vertex_shader, composite_fragment_shader, { "pos" });
+    SAFE_GL(glUseProgram(m_compositeProgram));
+    SAFE_GL(glUniform1i(glGetUniformLocation(m_compositeProgram, "frame"), 0));
+    SAFE_GL(glUniform1i(glGetUniformLocation(m_compositeProgram, "bloom"), 1));
+
+    int w = width;
+    int h = height;
+
+    for(int i = 0; i < (quality == PostProcess::High ? 1 : 2); ++i)
+    {
+      w = (w + 1) / 2;
+      h = (h + 1) / 2;
+      m_levels.push_back(createRenderTarget(w, h));
+    }
+
+    m_blurTarget = createRenderTarget(w, h);
+  }
+
+  void createOverlay(ProgramCache& programs)
+  {
+    static const float corners[] = { 0, 0, 1, 0, 0, 1, 1, 1 };
+
+    m_overlayProgram = programs.create(overlay_vertex_shader, overlay_fragment_shader, { "corner", "rect", "quadColor" });
+    SAFE_GL(glUseProgram(m_overlayProgram));
+    SAFE_GL(glUniform2f(glGetUniformLocation(m_overlayProgram, "screenSize"), width, height));
+
+    SAFE_GL(glGenVertexArrays(1, &m_overlayVao));
+    SAFE_GL(glBindVertexArray(m_overlayVao));
+
+    GLuint cornerVbo;
+    SAFE_GL(glGenBuffers(1, &cornerVbo));
+    SAFE_GL(glBindBuffer(GL_ARRAY_BUFFER, cornerVbo));
+    SAFE_GL(glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW));
+    SAFE_GL(glEnableVertexAttribArray(attrib_corner));
+    SAFE_GL(glVertexAttribPointer(attrib_corner, 2, GL_FLOAT, GL_FALSE, 0, nullptr));
+
+    SAFE_GL(glGenBuffers(1, &m_quadVbo));
+    SAFE_GL(glBindBuffer(GL_ARRAY_BUFFER, m_quadVbo));
+    SAFE_GL(glEnableVertexAttribArray(attrib_rect));
+    SAFE_GL(glVertexAttribPointer(attrib_rect, 4, GL_SHORT, GL_FALSE, sizeof(Quad), (GLvoid*)offsetof(Quad, x)));
+    SAFE_GL(glVertexAttribDivisor(attrib_rect, 1));
+    SAFE_GL(glEnableVertexAttribArray(attrib_color));
+    SAFE_GL(glVertexAttribPointer(attrib_color, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Quad), (GLvoid*)offsetof(Quad, color)));
+    SAFE_GL(glVertexAttribDivisor(attrib_color, 1));
   }
 
   ~Display()
   {
+    m_capture.reset();
     SDL_GL_DeleteContext(m_context);
     SDL_DestroyWindow(m_window);
   }
 
-  void refresh(const uint32_t* pixels)
+  void renderPass(RenderTarget const& target, GLuint source)
+  {
+    SAFE_GL(glBindFramebuffer(GL_FRAMEBUFFER, target.fbo));
+    SAFE_GL(glViewport(0, 0, target.width, target.height));
+    SAFE_GL(glBindTexture(GL_TEXTURE_2D, source));
+    SAFE_GL(glDrawArrays(GL_TRIANGLES, 0, 3));
+  }
+
+  // Downsamples the frame, blurs the smallest level, and adds it to the
+  // frame, into the output.
+  void renderBloom()
+  {
+    SAFE_GL(glUseProgram(m_downsampleProgram));
+
+    auto source = m_frame.texture;
+
+    for(auto& level : m_levels)
+    {
+      renderPass(level, source);
+      source = level.texture;
+    }
+
+    auto& bloom = m_levels.back();
+
+    SAFE_GL(glUseProgram(m_blurProgram));
+    SAFE_GL(glUniform2f(m_blurDirection, 1.0f / bloom.width, 0));
+    renderPass(m_blurTarget, bloom.texture);
+    SAFE_GL(glUniform2f(m_blurDirection, 0, 1.0f / bloom.height));
+    renderPass(bloom, m_blurTarget.texture);
+
+    SAFE_GL(glUseProgram(m_compositeProgram));
+    SAFE_GL(glActiveTexture(GL_TEXTURE1));
+    SAFE_GL(glBindTexture(GL_TEXTURE_2D, bloom.texture));
+    SAFE_GL(glActiveTexture(GL_TEXTURE0));
+    renderPass(m_output, m_frame.texture);
+  }
+
+  void refresh(const uint32_t* pixels, const Quad* quads, int quadCount) override
   {
-    SAFE_GL(glClearColor(0, 1, 0, 1));
+    SAFE_GL(glBindTexture(GL_TEXTURE_2D, m_frame.texture));
+    SAFE_GL(glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_BGRA, GL_UNSIGNED_BYTE, pixels));
+
+    // the quads are part of the frame: they glow like the rest
+    if(quadCount > 0)
+    {
+      SAFE_GL(glBindFramebuffer(GL_FRAMEBUFFER, m_frame.fbo));
+      SAFE_GL(glViewport(0, 0, width, height));
+
+      // orphan the previous quads, the GPU may still be reading them
+      SAFE_GL(glUseProgram(m_overlayProgram));
+      SAFE_GL(glBindVertexArray(m_overlayVao));
+      SAFE_GL(glBindBuffer(GL_ARRAY_BUFFER, m_quadVbo));
+      SAFE_GL(glBufferData(GL_ARRAY_BUFFER, quadCount * sizeof(Quad), nullptr, GL_STREAM_DRAW));
+      SAFE_GL(glBufferSubData(GL_ARRAY_BUFFER, 0, quadCount * sizeof(Quad), quads));
+      SAFE_GL(glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, quadCount));
+    }
+
+    SAFE_GL(glBindVertexArray(m_vao));
+
+    if(!m_levels.empty())
+      renderBloom();
+
+    // integer zoom, flipped: the output is top-down
+    SAFE_GL(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+    SAFE_GL(glViewport(0, 0, m_windowWidth, m_windowHeight));
+    SAFE_GL(glClearColor(0, 0, 0, 1));
     SAFE_GL(glClear(GL_COLOR_BUFFER_BIT));
-    SAFE_GL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_BGRA, GL_UNSIGNED_BYTE, pixels));
-    SAFE_GL(glDrawArrays(GL_TRIANGLES, 0, sizeof(vertices) / sizeof(*vertices)));
+
+    SAFE_GL(glBindFramebuffer(GL_READ_FRAMEBUFFER, m_output.fbo));
+    SAFE_GL(glBlitFramebuffer(0, 0, width, height,
+                              m_originX, m_originY + height * m_scale, m_originX + width * m_scale, m_originY,
+                              GL_COLOR_BUFFER_BIT, GL_NEAREST));
+    SAFE_GL(glBindFramebuffer(GL_READ_FRAMEBUFFER, 0));
+
+    if(m_capture)
+      m_capture->capture();
 
     SDL_GL_SwapWindow(m_window);
   }
 
+  void setCapture(const char* dir) override
+  {
+    m_capture.reset();
+
+    if(dir)
+      m_capture = make_unique<FrameCapture>(dir, m_originX, m_originY, width * m_scale, height * m_scale);
+  }
+
   const int width, height;
+  int m_windowWidth, m_windowHeight;
+  int m_scale;
+  int m_originX, m_originY;
+  unique_ptr<FrameCapture> m_capture;
+  GLuint m_vao;
+  RenderTarget m_frame; // the pixels, as uploaded
+  RenderTarget m_output; // what gets zoomed into the window
+  GLuint m_downsampleProgram = 0;
+  GLuint m_blurProgram = 0;
+  GLint m_blurDirection = -1;
+  GLuint m_compositeProgram = 0;
+  vector<RenderTarget> m_levels; // 1/2, 1/4...
+  RenderTarget m_blurTarget {};
+  GLuint m_overlayProgram;
+  GLuint m_overlayVao;
+  GLuint m_quadVbo;
   SDL_GLContext m_context;
   SDL_Window* m_window;
 };
+
+// No window, no GPU: each frame is only hashed (and dumped, when capturing).
+struct HeadlessDisplay : IDisplay
+{
+  HeadlessDisplay(int width_, int height_) : width(width_), height(height_)
+  {
+  }
+
+  ~HeadlessDisplay()
+  {
+    printf("[headless] %d frames, hash: %016llx\n", frameCount, (unsigned long long)hash);
+  }
+
+  void refresh(const uint32_t* pixels, const Quad* quads, int quadCount) override
+  {
+    if(quadCount > 0)
+      pixels = composite(pixels, quads, quadCount);
+
+    // FNV-1a, 64 bits at a time
+    auto words = (const uint64_t*)pixels;
+    uint64_t frameHash = 0xcbf29ce484222325ULL;
+
+    for(int i = 0; i < width * height / 2; ++i)
+    {
+      frameHash ^= words[i];
+      frameHash *= 0x100000001b3ULL;
+    }
+
+    hash = (hash ^ frameHash) * 0x100000001b3ULL;
+    frameCount++;
+
+    if(m_recorder)
+      m_recorder->write((const uint8_t*)pixels);
+  }
+
+  // Draws the quads like the GPU overlay does, on a copy of the pixels.
+  const uint32_t* composite(const uint32_t* pixels, const Quad* quads, int quadCount)
+  {
+    m_composite.assign(pixels, pixels + width * height);
+
+    for(int i = 0; i < quadCount; ++i)
+    {
+      auto& q = quads[i];
+      int x0 = max<int>(q.x, 0), x1 = min(q.x + q.w, width);
+      int y0 = max<int>(q.y, 0), y1 = min(q.y + q.h, height);
+
+      for(int y = y0; y < y1; ++y)
+        fill(&m_composite[y * width + x0], &m_composite[y * width + x1], q.color);
+    }
+
+    return m_composite.data();
+  }
+
+  void setCapture(const char* dir) override
+  {
+    m_recorder.reset();
+
+    if(dir)
+      m_recorder = createRecorder(dir, width, height, false);
+  }
+
+  const int width, height;
+  unique_ptr<IRecorder> m_recorder;
+  vector<uint32_t> m_composite;
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  int frameCount = 0;
+};
+
+// Texels between the tiles of a mosaic: they stay black.
+auto const MOSAIC_GAP = 1;
+
+// The atlas holds the tiles as they're laid out on screen: a tile update
+// is one upload, and the whole grid is one draw call.
+struct MosaicDisplay : IMosaicDisplay
+{
+  MosaicDisplay(int tileWidth_, int tileHeight_, int columns_, int rows_) :
+    tileWidth(tileWidth_),
+    tileHeight(tileHeight_),
+    columns(columns_),
+    width(columns_ * (tileWidth_ + MOSAIC_GAP) - MOSAIC_GAP),
+    height(rows_ * (tileHeight_ + MOSAIC_GAP) - MOSAIC_GAP)
+  {
+    openWindow("Literace mosaic", width, height, false, m_window, m_context);
+
+    int windowWidth, windowHeight;
+    SDL_GL_GetDrawableSize(m_window, &windowWidth, &windowHeight);
+    int scale = max(1, min(windowWidth / width, windowHeight / height));
+
+    m_vao = createPassVao();
+
+    vector<uint32_t> black(width * height);
+    SAFE_GL(glGenTextures(1, &m_atlas));
+    SAFE_GL(glBindTexture(GL_TEXTURE_2D, m_atlas));
+    SAFE_GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+    SAFE_GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+    SAFE_GL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_BGRA, GL_UNSIGNED_BYTE, black.data()));
+
+    {
+      ProgramCache programs;
+      m_program = programs.create(pass_vertex_shader, mosaic_fragment_shader, { "pos" });
+    }
+
+    SAFE_GL(glUseProgram(m_program));
+    SAFE_GL(glUniform1i(glGetUniformLocation(m_program, "atlas"), 0));
+    SAFE_GL(glUniform2i(glGetUniformLocation(m_program, "origin"), (windowWidth - width * scale) / 2, (windowHeight - height * scale) / 2));
+    SAFE_GL(glUniform1i(glGetUniformLocation(m_program, "scale"), scale));
+
+    SAFE_GL(glViewport(0, 0, windowWidth, windowHeight));
+
+    printf("[display] mosaic of %dx%d tiles of %dx%d, x%d in a %dx%d window\n",
+           columns, rows_, tileWidth, tileHeight, scale, windowWidth, windowHeight);
+  }
+
+  ~MosaicDisplay()
+  {
+    SDL_GL_DeleteContext(m_context);
+    SDL_DestroyWindow(m_window);
+  }
+
+  void updateTile(int index, const uint32_t* pixels) override
+  {
+    int x = (index % columns) * (tileWidth + MOSAIC_GAP);
+    int y = (index / columns) * (tileHeight + MOSAIC_GAP);
+
+    SAFE_GL(glBindTexture(GL_TEXTURE_2D, m_atlas));
+    SAFE_GL(glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, tileWidth, tileHeight, GL_BGRA, GL_UNSIGNED_BYTE, pixels));
+  }
+
+  void refresh() override
+  {
+    SAFE_GL(glUseProgram(m_program));
+    SAFE_GL(glBindVertexArray(m_vao));
+    SAFE_GL(glBindTexture(GL_TEXTURE_2D, m_atlas));
+    SAFE_GL(glDrawArrays(GL_TRIANGLES, 0, 3));
+
+    SDL_GL_SwapWindow(m_window);
+  }
+
+  const int tileWidth, tileHeight;
+  const int columns;
+  const int width, height; // of the atlas
+  GLuint m_vao;
+  GLuint m_atlas;
+  GLuint m_program;
+  SDL_GLContext m_context;
+  SDL_Window* m_window;
+};
+
+struct HeadlessMosaicDisplay : IMosaicDisplay
+{
+  HeadlessMosaicDisplay(int tileWidth_, int tileHeight_, int columns_, int rows_) :
+    tileWidth(tileWidth_),
+    tileHeight(tileHeight_),
+    columns(columns_),
+    width(columns_ * (tileWidth_ + MOSAIC_GAP) - MOSAIC_GAP),
+    height(rows_ * (tileHeight_ + MOSAIC_GAP) - MOSAIC_GAP),
+    atlas(width * height)
+  {
+  }
+
+  ~HeadlessMosaicDisplay()
+  {
+    printf("[headless] %d frames, hash: %016llx\n", frameCount, (unsigned long long)hash);
+  }
+
+  void updateTile(int index, const uint32_t* pixels) override
+  {
+    int x = (index % columns) * (tileWidth + MOSAIC_GAP);
+    int y = (index / columns) * (tileHeight + MOSAIC_GAP);
+
+    for(int row = 0; row < tileHeight; ++row)
+      copy(pixels + row * tileWidth, pixels + (row + 1) * tileWidth, &atlas[(y + row) * width + x]);
+  }
+
+  void refresh() override
+  {
+    uint64_t frameHash = 0xcbf29ce484222325ULL;
+
+    for(auto pixel : atlas)
+    {
+      frameHash ^= pixel;
+      frameHash *= 0x100000001b3ULL;
+    }
+
+    hash = (hash ^ frameHash) * 0x100000001b3ULL;
+    frameCount++;
+  }
+
+  const int tileWidth, tileHeight;
+  const int columns;
+  const int width, height;
+  vector<uint32_t> atlas;
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  int frameCount = 0;
+};
 }
 
-unique_ptr<IDisplay> createDisplay(int width, int height)
+unique_ptr<IDisplay> createDisplay(int width, int height, bool headless, DisplayConfig config)
 {
-  return std::make_unique<Display>(width, height);
+  if(headless)
+    return std::make_unique<HeadlessDisplay>(width, height);
+
+  return std::make_unique<Display>(width, height, config);
 }
 
+unique_ptr<IMosaicDisplay> createMosaicDisplay(int tileWidth, int tileHeight, int columns, int rows, bool headless)
+{
+  if(headless)
+    return std::make_unique<HeadlessMosaicDisplay>(tileWidth, tileHeight, columns, rows);
+
+  return std::make_unique<MosaicDisplay>(tileWidth, tileHeight, columns, rows);
+}
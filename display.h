@@ -1,12 +1,61 @@
+#pragma once
+
 #include <cstdint>
 #include <memory>
 
 using std::unique_ptr;
 
+// A solid rectangle, drawn over the pixels (screen coordinates).
+struct Quad
+{
+  int16_t x, y, w, h;
+  uint32_t color; // as the pixels
+};
+
+enum class PostProcess
+{
+  Off,
+  Low,
+  High,
+};
+
+struct DisplayConfig
+{
+  int scale = 1; // integer zoom of the frames into the window
+  bool fullscreen = false; // then, the largest zoom that fits the screen
+  PostProcess postProcess = PostProcess::High; // the glow
+};
+
 struct IDisplay
 {
-  virtual void refresh(const uint32_t* pixels) = 0;
+  virtual ~IDisplay() = default;
+
+  // The quads are drawn in order, on top of the pixels.
+  virtual void refresh(const uint32_t* pixels, const Quad* quads = nullptr, int quadCount = 0) = 0;
+
+  // Starts recording the presented frames to 'dir', or stops if null.
+  virtual void setCapture(const char* dir) = 0;
 };
 
-unique_ptr<IDisplay> createDisplay(int width, int height);
+// 'headless' selects a software sink that needs no window: each frame is
+// hashed, and the final hash is printed on exit (golden tests on CI).
+// It ignores the config.
+unique_ptr<IDisplay> createDisplay(int width, int height, bool headless = false, DisplayConfig config = DisplayConfig());
+
+// Many arenas in one window: a grid of tiles, all in one texture atlas,
+// drawn at once.
+struct IMosaicDisplay
+{
+  virtual ~IMosaicDisplay() = default;
+
+  // Uploads the pixels of tile 'index' (tileWidth x tileHeight, as the
+  // frames of IDisplay). Only the tiles that changed need updating.
+  virtual void updateTile(int index, const uint32_t* pixels) = 0;
+
+  // Draws the grid, and presents it.
+  virtual void refresh() = 0;
+};
 
+// 'columns' x 'rows' tiles, with a thin gap between them. 'headless' is as
+// for createDisplay: the frames are only hashed.
+unique_ptr<IMosaicDisplay> createMosaicDisplay(int tileWidth, int tileHeight, int columns, int rows, bool headless = false);
@@ -2,27 +2,139 @@
 // Game logic.
 // No SDL or I/O should appear here.
 #include "game.h"
+#include "board.h"
+#include "trails.h"
+#include "obstacles.h"
+#include "threadpool.h"
 #include <cstdio>
 #include <cstdlib>
 #include <cassert>
+#include <cstdint>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+using std::min;
+using std::max;
+using std::fill;
 
 namespace
 {
+struct Span
+{
+  int begin, end;
+};
+
+// A part of the screen.
+struct Area
+{
+  Span x, y;
+};
+
 struct Game : IGame
 {
+  Game(GameConfig config_) :
+    config(config_),
+    width(config.width),
+    height(config.height),
+    turnsPerSecond(config.turnsPerSecond),
+    speed(max(1, config.speed)),
+    boostSpeed(max(1, config.boostSpeed)),
+    obstacleCount(config.obstacleCount),
+    obstacles(width, height),
+    board(width, height),
+    trails(width, height)
+  {
+    chunkIsDirty.resize(board.chunksX * board.chunksY);
+
+    if(config.threadCount != 1)
+      pool = std::make_unique<ThreadPool>(config.threadCount);
+  }
+
+  const GameConfig config;
+  const int width, height;
+  const int turnsPerSecond;
+  const int speed, boostSpeed; // in cells per turn
+  int turnAccumulator = 0;
   Bike bikes[MAX_PLAYERS];
-  vector<Obstacle> obstacles;
-  char board[BOARD_WIDTH * BOARD_HEIGHT];
+  const int obstacleCount;
+  Obstacles obstacles;
+  vector<int> obstacleJitter;
+  vector<Obstacle> obstacleList; // for the spectator
+  vector<Board::Rect> erasedRects;
+  Board board;
+  Trails trails;
+
+  // What the last draw left in its pixels: as long as the viewport stays
+  // put, only the chunks changed since then are repainted.
+  const int* drawnPixels = nullptr;
+  Vec2 drawnViewport {};
+  vector<bool> chunkIsDirty;
+  vector<int> dirtyChunks;
+  vector<Area> dirtyAreas; // the dirty chunks, on screen
   IEventSink* sink = &nullSink;
+  ISpectator* spectator = &nullSpectator;
   ITerminal* terminal = &nullTerminal;
+  ITurnListener* turnListener = nullptr;
+  unique_ptr<ThreadPool> pool; // null: everything runs on the calling thread
   int frameCount;
   bool gameIsOver;
-  int gameOverDelay;
+  int gameOverDelay = 0;
+
+  // The hash of everything but the board cells, which the board hashes
+  // itself. Bikes and obstacles all move every turn: it's recomputed once
+  // per turn, in O(bikes + obstacles).
+  uint64_t entitiesHash = 0;
 
   int update(GameInput input) override;
+  int getIdleTicks() override;
+  void skipTicks(int count) override;
+  void reset(unsigned seed) override;
   void draw(int* pixels) override;
+  void oneTurn(GameInput input) override;
+  bool isRoundOver() override;
+  int getFrameCount() override;
+  GameConfig getConfig() override;
+  Bike const* getBikes() override;
+  Board const& getBoard() override;
+  int getTrailOwner(Vec2 pos) override;
+  int getTrailLength(int team) override;
+  void setTurnListener(ITurnListener* listener) override;
+  void saveState(vector<uint8_t>& out) override;
+  void loadState(const uint8_t* data, size_t size) override;
+  void checkpoint() override;
+  void rollback() override;
+  uint64_t getStateHash() override;
+
+  // Each game has its own random sequence: games can run on several
+  // threads, and be replayed.
+  int random()
+  {
+    // xorshift32
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState & 0x7fffffff;
+  }
 
-  void oneTurn(GameInput input);
+  uint32_t rngState;
+
+  // The state at the last checkpoint. The chunks changed since are the
+  // dirty ones: a scratch game is never drawn.
+  struct Checkpoint
+  {
+    unique_ptr<Board> board;
+    Bike bikes[MAX_PLAYERS];
+    int frameCount;
+    uint32_t rngState;
+    bool gameIsOver;
+    int gameOverDelay;
+    uint64_t entitiesHash;
+    unique_ptr<Obstacles> obstacles;
+    vector<TrailSegment> trails[MAX_PLAYERS];
+  };
+
+  Checkpoint saved;
 };
 
 const int dirs[][2] =
@@ -69,42 +181,171 @@ void updateBikeDirection(Game& game, Bike& bike, PlayerInput input, int team)
   }
 }
 
-Vec2 computeNextBikePosition(Bike& bike, PlayerInput input)
+// Cells crossed this turn.
+int computeBikeSpeed(Game& game, Bike const& bike, PlayerInput input)
+{
+  if(bike.direction == Direction::Idle)
+    return 0;
+
+  return input.boost ? game.boostSpeed : game.speed;
+}
+
+// One cell further in 'direction', around the torus.
+Vec2 step(Game& game, Vec2 pos, Direction direction)
+{
+  pos.x += dirs[(int)direction][0];
+  pos.y += dirs[(int)direction][1];
+
+  if(pos.x < 0)
+    pos.x += game.width;
+  else if(pos.x == game.width)
+    pos.x = 0;
+
+  if(pos.y < 0)
+    pos.y += game.height;
+  else if(pos.y == game.height)
+    pos.y = 0;
+
+  return pos;
+}
+
+// Whether two bikes run into each other this turn: they reach the same
+// cell at the same step of their moves, or swap cells. A bike stays put
+// once it has made all its steps.
+bool willMeet(Game& game, Bike const& a, int speedA, Bike const& b, int speedB)
+{
+  auto prevA = a.pos;
+  auto prevB = b.pos;
+
+  for(int k = 0; k < max(max(speedA, speedB), 1); ++k)
+  {
+    auto posA = k < speedA ? step(game, prevA, a.direction) : prevA;
+    auto posB = k < speedB ? step(game, prevB, b.direction) : prevB;
+
+    if(posA == posB || (posA == prevB && posB == prevA))
+      return true;
+
+    prevA = posA;
+    prevB = posB;
+  }
+
+  return false;
+}
+
+void markChunkDirty(Game& game, int x, int y)
+{
+  int index = (y >> Board::CHUNK_BITS) * game.board.chunksX + (x >> Board::CHUNK_BITS);
+
+  if(game.chunkIsDirty[index])
+    return;
+
+  game.chunkIsDirty[index] = true;
+  game.dirtyChunks.push_back(index);
+}
+
+// Marks the chunks covered by a rectangle (which wraps around the edges).
+void markRectangleDirty(Game& game, Vec2 pos, Vec2 size)
 {
-  int speed = 1;
+  int w = min(size.x, game.width);
+  int h = min(size.y, game.height);
 
-  if(input.boost)
-    speed = 2;
+  for(int dy = 0; dy < h;)
+  {
+    int y = (pos.y + dy) % game.height;
 
-  int dx = dirs[(int)bike.direction][0];
-  int dy = dirs[(int)bike.direction][1];
+    for(int dx = 0; dx < w;)
+    {
+      int x = (pos.x + dx) % game.width;
+      markChunkDirty(game, x, y);
+      dx += min(Board::CHUNK_SIZE - (x & (Board::CHUNK_SIZE - 1)), game.width - x);
+    }
 
-  Vec2 nextPos;
-  nextPos.x = bike.pos.x + dx * speed;
-  nextPos.y = bike.pos.y + dy * speed;
+    dy += min(Board::CHUNK_SIZE - (y & (Board::CHUNK_SIZE - 1)), game.height - y);
+  }
+}
 
-  nextPos.x = (nextPos.x + BOARD_WIDTH) % BOARD_WIDTH;
-  nextPos.y = (nextPos.y + BOARD_HEIGHT) % BOARD_HEIGHT;
-  return nextPos;
+void claimCell(Game& game, Bike& bike, int team)
+{
+  game.board.set(bike.pos.x, bike.pos.y, team);
+  markChunkDirty(game, bike.pos.x, bike.pos.y);
+  game.trails.onMove(team, bike.pos, bike.direction, 1);
+  game.spectator->onCell(bike.pos, team);
 }
 
+// Sweeps the cells crossed this turn, in order: each one is tested, then
+// claimed, so that no trail can be jumped over, whatever the speed.
 void updateBike(Game& game, Bike& bike, PlayerInput input, int team)
 {
-  auto oldPos = bike.pos;
-  auto nextPos = computeNextBikePosition(bike, input);
+  int speed = computeBikeSpeed(game, bike, input);
 
-  if(oldPos != nextPos)
+  for(int k = 0; k < speed; ++k)
   {
-    bike.pos = nextPos;
+    bike.pos = step(game, bike.pos, bike.direction);
 
-    if(game.board[bike.pos.y * BOARD_WIDTH + bike.pos.x])
+    // the last cell is tested against the obstacles next turn, once they've moved
+    if(k + 1 < speed && game.obstacles.hits(bike.pos))
     {
-      game.sink->onKilled(game.frameCount, team, game.board[bike.pos.y * BOARD_WIDTH + bike.pos.x]);
+      game.sink->onCrash(game.frameCount, { team - 1 });
       bike.alive = false;
+      return;
     }
+
+    if(auto owner = game.board.get(bike.pos.x, bike.pos.y))
+    {
+      game.sink->onKilled(game.frameCount, team, owner);
+      bike.alive = false;
+
+      // the cell changes hands
+      game.trails.erase(bike.pos, { 1, 1 });
+      claimCell(game, bike, team);
+      return;
+    }
+
+    claimCell(game, bike, team);
+  }
+
+  // not moving yet: still holds its cell
+  if(speed == 0)
+    claimCell(game, bike, team);
+}
+
+uint64_t hashCombine(uint64_t h, int64_t value)
+{
+  // splitmix64 finalizer
+  uint64_t z = h ^ (value + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2));
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+void updateEntitiesHash(Game& game)
+{
+  uint64_t h = 0;
+  h = hashCombine(h, game.frameCount);
+  h = hashCombine(h, game.rngState);
+  h = hashCombine(h, game.gameIsOver);
+
+  for(auto& bike : game.bikes)
+  {
+    h = hashCombine(h, bike.alive);
+    h = hashCombine(h, bike.pos.x);
+    h = hashCombine(h, bike.pos.y);
+    h = hashCombine(h, (int)bike.direction);
+  }
+
+  auto& obstacles = game.obstacles;
+
+  for(int i = 0; i < obstacles.size(); ++i)
+  {
+    h = hashCombine(h, obstacles.x[i]);
+    h = hashCombine(h, obstacles.y[i]);
+    h = hashCombine(h, obstacles.vx[i]);
+    h = hashCombine(h, obstacles.vy[i]);
+    h = hashCombine(h, obstacles.w[i]);
+    h = hashCombine(h, obstacles.h[i]);
   }
 
-  game.board[bike.pos.y * BOARD_WIDTH + bike.pos.x] = team;
+  game.entitiesHash = h;
 }
 
 bool isGameOver(Game& game)
@@ -119,67 +360,75 @@ bool isGameOver(Game& game)
 }
 }
 
-std::unique_ptr<IGame> createGame(ITerminal* terminal, IEventSink* sink)
+std::unique_ptr<IGame> createGame(ITerminal* terminal, IEventSink* sink, ISpectator* spectator, GameConfig config)
 {
-  auto pGame = std::make_unique<Game>();
+  auto pGame = std::make_unique<Game>(config);
   auto& game = *pGame;
 
   game.terminal = terminal;
   game.sink = sink;
+  game.spectator = spectator;
+
+  game.reset(config.seed);
+
+  return pGame;
+}
+
+void Game::reset(unsigned seed)
+{
+  auto& game = *this;
+
+  game.rngState = seed * 2654435761u + 1;
+
+  // xorshift32 would stay stuck at zero (one seed maps to it)
+  if(!game.rngState)
+    game.rngState = 1;
+  game.turnAccumulator = 0;
 
   int k = 0;
 
   for(auto& bike : game.bikes)
   {
     bike = {};
-    bike.pos.x = (k + 1) * BOARD_WIDTH / (MAX_PLAYERS + 1);
-    bike.pos.y = BOARD_HEIGHT / 2;
+    bike.pos.x = (k + 1) * game.width / (MAX_PLAYERS + 1);
+    bike.pos.y = game.height / 2;
     bike.direction = Direction::Up;
 
     ++k;
   }
 
-  for(auto& cell : game.board)
-    cell = 0;
+  game.board.clear();
+  game.trails.clear();
 
   game.obstacles.clear();
 
-  int obCount = rand() % 3 + 1;
+  int obCount = game.random() % 3 + 1;
+
+  if(game.obstacleCount > 0)
+    obCount = game.obstacleCount;
 
   for(int k = 0; k < obCount; ++k)
   {
-    Vec2 pos = { rand() % BOARD_WIDTH, rand() % BOARD_HEIGHT };
-    Vec2 vel = { rand() % 3 - 1, rand() % 3 - 1 };
-    Vec2 size = { rand() % 200 + 20, rand() % 200 + 20 };
-    game.obstacles.push_back({ pos, vel, size, true });
+    Vec2 pos = { game.random() % game.width, game.random() % game.height };
+    Vec2 vel = { game.random() % 3 - 1, game.random() % 3 - 1 };
+    Vec2 size = { game.random() % 200 + 20, game.random() % 200 + 20 };
+    game.obstacles.add({ pos, vel, size, true });
   }
 
   game.frameCount = 0;
   game.gameIsOver = false;
 
-  return pGame;
-}
-
-bool pointInsideSegment(int p, int left, int width, int mod)
-{
-  p = (p + mod) % mod;
-  left = (left + mod) % mod;
+  // the next draw repaints everything
+  game.drawnPixels = nullptr;
 
-  while(p < left)
-    p += mod;
+  for(auto index : game.dirtyChunks)
+    game.chunkIsDirty[index] = false;
 
-  return p >= left && p <= left + width;
-}
+  game.dirtyChunks.clear();
 
-bool pointInsideRectangle(Vec2 pos, Vec2 rectPos, Vec2 rectSize)
-{
-  if(!pointInsideSegment(pos.x, rectPos.x, rectSize.x, BOARD_WIDTH))
-    return false;
+  updateEntitiesHash(game);
 
-  if(!pointInsideSegment(pos.y, rectPos.y, rectSize.y, BOARD_HEIGHT))
-    return false;
-
-  return true;
+  game.spectator->onNewRound(game.width, game.height, game.turnsPerSecond);
 }
 
 void checkForCollisions(Game& game, GameInput input)
@@ -189,16 +438,12 @@ void checkForCollisions(Game& game, GameInput input)
     if(!game.bikes[i].alive)
       continue;
 
-    for(auto& ob : game.obstacles)
-    {
-      auto& bike = game.bikes[i];
+    auto& bike = game.bikes[i];
 
-      if(pointInsideRectangle(bike.pos, ob.pos, ob.size))
-      {
-        game.sink->onCrash(game.frameCount, { i });
-        bike.alive = false;
-        break;
-      }
+    if(game.obstacles.hits(bike.pos))
+    {
+      game.sink->onCrash(game.frameCount, { i });
+      bike.alive = false;
     }
 
     for(int j = i + 1; j < MAX_PLAYERS; ++j)
@@ -206,13 +451,10 @@ void checkForCollisions(Game& game, GameInput input)
       if(!game.bikes[j].alive)
         continue;
 
-      auto pos1 = game.bikes[i].pos;
-      auto nextPos1 = computeNextBikePosition(game.bikes[i], input.players[i]);
-      auto pos2 = game.bikes[j].pos;
-      auto nextPos2 = computeNextBikePosition(game.bikes[j], input.players[j]);
+      auto speed1 = computeBikeSpeed(game, game.bikes[i], input.players[i]);
+      auto speed2 = computeBikeSpeed(game, game.bikes[j], input.players[j]);
 
-      if(nextPos1 == nextPos2
-         || (nextPos1 == pos2 && nextPos2 == pos1))
+      if(willMeet(game, game.bikes[i], speed1, game.bikes[j], speed2))
       {
         game.sink->onCrash(game.frameCount, { i, j });
         game.bikes[i].alive = false;
@@ -232,47 +474,41 @@ bool allBikeReady(Game& game)
   return true;
 }
 
+// Everything but the board and the trails, which erase all the obstacles at once.
 void eraseRectangle(Game& game, Vec2 pos, Vec2 size)
 {
-  for(int y = 0; y < size.y; ++y)
-    for(int x = 0; x < size.x; ++x)
-    {
-      int xm = (pos.x + x) % BOARD_WIDTH;
-      int ym = (pos.y + y) % BOARD_HEIGHT;
-      assert(xm >= 0);
-      assert(ym >= 0);
-      game.board[ym * BOARD_WIDTH + xm] = 0;
-    }
+  assert(pos.x >= 0);
+  assert(pos.y >= 0);
+  markRectangleDirty(game, pos, size);
+
+  game.spectator->onErase(pos, size);
 }
 
 void updateObstacles(Game& game)
 {
-  for(auto& ob : game.obstacles)
-  {
-    ob.pos.x += rand() % 3 - 1;
-    ob.pos.y += rand() % 3 - 1;
-    ob.pos.x += ob.vel.x;
-    ob.pos.y += ob.vel.y;
-    ob.size.x += rand() % 3 - 1;
-    ob.size.y += rand() % 3 - 1;
+  auto& obstacles = game.obstacles;
+  int count = obstacles.size();
 
-    if(ob.pos.x < 0)
-      ob.vel.x = abs(ob.vel.x);
+  // draw the random moves first, in the order the RNG was always consumed
+  auto& jitter = game.obstacleJitter;
+  jitter.resize(count * 4);
 
-    if(ob.pos.x >= BOARD_WIDTH)
-      ob.vel.x = -abs(ob.vel.x);
+  for(auto& j : jitter)
+    j = game.random() % 3 - 1;
 
-    if(ob.pos.y < 0)
-      ob.vel.y = abs(ob.vel.y);
+  obstacles.move(jitter.data());
 
-    if(ob.pos.y >= BOARD_HEIGHT)
-      ob.vel.y = -abs(ob.vel.y);
+  auto& rects = game.erasedRects;
+  rects.resize(count);
 
-    ob.pos.x = (ob.pos.x + BOARD_WIDTH) % BOARD_WIDTH;
-    ob.pos.y = (ob.pos.y + BOARD_HEIGHT) % BOARD_HEIGHT;
+  for(int i = 0; i < count; ++i)
+    rects[i] = { obstacles.x[i], obstacles.y[i], obstacles.w[i], obstacles.h[i] };
 
-    eraseRectangle(game, ob.pos, ob.size);
-  }
+  game.board.eraseRectangles(rects.data(), count, game.pool.get());
+  game.trails.eraseRectangles(rects.data(), count);
+
+  for(int i = 0; i < count; ++i)
+    eraseRectangle(game, { obstacles.x[i], obstacles.y[i] }, { obstacles.w[i], obstacles.h[i] });
 }
 
 void Game::oneTurn(GameInput input)
@@ -285,12 +521,16 @@ void Game::oneTurn(GameInput input)
     {
       game.gameIsOver = true;
       game.gameOverDelay = 1000;
+      updateEntitiesHash(game);
       game.sink->onRoundFinished();
     }
 
     return;
   }
 
+  if(game.turnListener)
+    game.turnListener->onTurn(game, game.frameCount, input);
+
   for(int i = 0; i < MAX_PLAYERS; ++i)
     updateBikeDirection(game, game.bikes[i], input.players[i], 1 + i);
 
@@ -305,16 +545,26 @@ void Game::oneTurn(GameInput input)
 
   updateObstacles(game);
   game.frameCount++;
+  updateEntitiesHash(game);
+
+  if(game.spectator != &nullSpectator)
+  {
+    game.obstacleList.resize(game.obstacles.size());
+
+    for(int i = 0; i < game.obstacles.size(); ++i)
+      game.obstacleList[i] = game.obstacles.get(i);
+
+    game.spectator->onFrame(game.frameCount, game.bikes, game.obstacleList);
+  }
 }
 
 int Game::update(GameInput input)
 {
-  static int turnAccumulator = 0;
-  turnAccumulator += 100;
+  turnAccumulator += turnsPerSecond;
 
   while(turnAccumulator > 0)
   {
-    turnAccumulator -= 500;
+    turnAccumulator -= TICKS_PER_SECOND;
     oneTurn(input);
   }
 
@@ -324,48 +574,576 @@ int Game::update(GameInput input)
   return gameIsOver && gameOverDelay == 0 ? 1 : 0;
 }
 
+int Game::getIdleTicks()
+{
+  return gameIsOver ? max(0, gameOverDelay - 1) : 0;
+}
+
+void Game::skipTicks(int count)
+{
+  count = min(count, getIdleTicks());
+
+  if(count <= 0)
+    return;
+
+  // the turns don't run anymore, but the accumulator keeps its phase
+  turnAccumulator += count * turnsPerSecond;
+
+  if(turnAccumulator > 0)
+    turnAccumulator -= (turnAccumulator + TICKS_PER_SECOND - 1) / TICKS_PER_SECOND * TICKS_PER_SECOND;
+
+  gameOverDelay -= count;
+}
+
+bool Game::isRoundOver()
+{
+  return isGameOver(*this);
+}
+
+int Game::getFrameCount()
+{
+  return frameCount;
+}
+
+GameConfig Game::getConfig()
+{
+  return config;
+}
+
+Bike const* Game::getBikes()
+{
+  return bikes;
+}
+
+Board const& Game::getBoard()
+{
+  return board;
+}
+
+int Game::getTrailOwner(Vec2 pos)
+{
+  return trails.owner(pos);
+}
+
+int Game::getTrailLength(int team)
+{
+  return trails.length(team);
+}
+
+void Game::setTurnListener(ITurnListener* listener)
+{
+  turnListener = listener;
+}
+
+namespace
+{
+// Saved state layout (native endianness):
+// StateHeader, StateObstacles, trail segments, then for each non-empty
+// chunk: StateChunk, cellCount * u16 cell index, cellCount * u8 team.
+struct StateBike
+{
+  int32_t alive;
+  int32_t x, y;
+  int32_t direction;
+};
+
+struct StateObstacle
+{
+  int32_t x, y;
+  int32_t vx, vy;
+  int32_t w, h;
+};
+
+struct StateHeader
+{
+  int32_t width, height;
+  int32_t frameCount;
+  uint32_t rngState;
+  int32_t gameIsOver;
+  int32_t gameOverDelay;
+  int32_t turnAccumulator;
+  StateBike bikes[MAX_PLAYERS];
+  int32_t obstacleCount;
+  int32_t segmentCounts[MAX_PLAYERS];
+  int32_t chunkCount;
+};
+
+struct StateChunk
+{
+  int32_t index;
+  int32_t cellCount;
+};
+
+void append(vector<uint8_t>& out, const void* data, size_t size)
+{
+  auto bytes = (const uint8_t*)data;
+  out.insert(out.end(), bytes, bytes + size);
+}
+
+// Reads a saved state: every count is checked against the bytes left.
+struct StateReader
+{
+  const uint8_t* data;
+  size_t size;
+
+  const uint8_t* skip(size_t count, size_t itemSize)
+  {
+    if(count > size / itemSize)
+      throw std::runtime_error("Corrupted saved game: truncated");
+
+    auto r = data;
+    data += count * itemSize;
+    size -= count * itemSize;
+    return r;
+  }
+
+  template<typename T>
+  T take()
+  {
+    T val;
+    memcpy(&val, skip(1, sizeof val), sizeof val);
+    return val;
+  }
+};
+
+void check(bool condition, const char* what)
+{
+  if(!condition)
+    throw std::runtime_error(std::string("Corrupted saved game: ") + what);
+}
+}
+
+void Game::saveState(vector<uint8_t>& out)
+{
+  StateHeader header {};
+  header.width = width;
+  header.height = height;
+  header.frameCount = frameCount;
+  header.rngState = rngState;
+  header.gameIsOver = gameIsOver;
+  header.gameOverDelay = gameOverDelay;
+  header.turnAccumulator = turnAccumulator;
+  header.obstacleCount = obstacles.size();
+
+  for(int i = 0; i < MAX_PLAYERS; ++i)
+  {
+    auto& bike = bikes[i];
+    header.bikes[i] = { bike.alive, bike.pos.x, bike.pos.y, (int)bike.direction };
+    header.segmentCounts[i] = trails.segments(1 + i).size();
+  }
+
+  for(int cy = 0; cy < board.chunksY; ++cy)
+    for(int cx = 0; cx < board.chunksX; ++cx)
+      header.chunkCount += board.getChunk(cx, cy) != nullptr;
+
+  append(out, &header, sizeof header);
+
+  for(int i = 0; i < obstacles.size(); ++i)
+  {
+    StateObstacle ob { obstacles.x[i], obstacles.y[i], obstacles.vx[i], obstacles.vy[i], obstacles.w[i], obstacles.h[i] };
+    append(out, &ob, sizeof ob);
+  }
+
+  for(int i = 0; i < MAX_PLAYERS; ++i)
+  {
+    auto& segments = trails.segments(1 + i);
+    append(out, segments.data(), segments.size() * sizeof(TrailSegment));
+  }
+
+  uint16_t cellIndices[Board::CHUNK_SIZE * Board::CHUNK_SIZE];
+  uint8_t teams[Board::CHUNK_SIZE * Board::CHUNK_SIZE];
+
+  for(int cy = 0; cy < board.chunksY; ++cy)
+  {
+    for(int cx = 0; cx < board.chunksX; ++cx)
+    {
+      auto chunk = board.getChunk(cx, cy);
+
+      if(!chunk)
+        continue;
+
+      StateChunk sc { cy * board.chunksX + cx, 0 };
+
+      for(int k = 0; k < Board::CHUNK_SIZE * Board::CHUNK_SIZE; ++k)
+      {
+        if(chunk->cells[k])
+        {
+          cellIndices[sc.cellCount] = k;
+          teams[sc.cellCount] = chunk->cells[k];
+          sc.cellCount++;
+        }
+      }
+
+      append(out, &sc, sizeof sc);
+      append(out, cellIndices, sc.cellCount * sizeof *cellIndices);
+      append(out, teams, sc.cellCount);
+    }
+  }
+}
+
+void Game::loadState(const uint8_t* data, size_t size)
+{
+  StateReader r { data, size };
+  auto header = r.take<StateHeader>();
+
+  if(header.width != width || header.height != height)
+    throw std::runtime_error("Can't load a saved game of another arena size");
+
+  check(header.obstacleCount >= 0 && header.chunkCount >= 0 && header.chunkCount <= board.chunksX * board.chunksY, "invalid counts");
+
+  for(auto& bike : header.bikes)
+    check(bike.x >= 0 && bike.x < width && bike.y >= 0 && bike.y < height && bike.direction >= 0 && bike.direction <= 4, "invalid bike");
+
+  frameCount = header.frameCount;
+  rngState = header.rngState;
+  gameIsOver = header.gameIsOver;
+  gameOverDelay = header.gameOverDelay;
+  turnAccumulator = header.turnAccumulator;
+
+  for(int i = 0; i < MAX_PLAYERS; ++i)
+  {
+    auto& bike = header.bikes[i];
+    bikes[i].alive = bike.alive;
+    bikes[i].pos = { bike.x, bike.y };
+    bikes[i].direction = (Direction)bike.direction;
+  }
+
+  obstacles.clear();
+  auto savedObstacles = r.skip(header.obstacleCount, sizeof(StateObstacle));
+
+  for(int i = 0; i < header.obstacleCount; ++i)
+  {
+    StateObstacle ob;
+    memcpy(&ob, savedObstacles + i * sizeof ob, sizeof ob);
+    check(ob.x >= 0 && ob.x < width && ob.y >= 0 && ob.y < height && abs(ob.vx) <= 1 && abs(ob.vy) <= 1 && ob.w >= 0 && ob.h >= 0, "invalid obstacle");
+    obstacles.add({ { ob.x, ob.y }, { ob.vx, ob.vy }, { ob.w, ob.h }, true });
+  }
+
+  for(int i = 0; i < MAX_PLAYERS; ++i)
+  {
+    check(header.segmentCounts[i] >= 0, "invalid counts");
+
+    vector<TrailSegment> segments(header.segmentCounts[i]);
+    auto saved = r.skip(segments.size(), sizeof(TrailSegment));
+
+    if(!segments.empty())
+      memcpy(segments.data(), saved, segments.size() * sizeof(TrailSegment));
+
+    for(auto& seg : segments)
+    {
+      // as made by Trails::onMove: never longer than the torus
+      int mod = seg.direction == Direction::Left || seg.direction == Direction::Right ? width : height;
+      check(seg.start.x >= 0 && seg.start.x < width && seg.start.y >= 0 && seg.start.y < height
+            && seg.direction >= Direction::Left && seg.direction <= Direction::Up
+            && seg.step >= 1 && seg.count >= 1 && (int64_t)seg.count * seg.step <= mod, "invalid trail");
+    }
+
+    trails.assign(1 + i, segments.data(), segments.size());
+  }
+
+  board.clear();
+
+  for(int i = 0; i < header.chunkCount; ++i)
+  {
+    auto sc = r.take<StateChunk>();
+    check(sc.index >= 0 && sc.index < board.chunksX * board.chunksY, "invalid chunk");
+    check(sc.cellCount >= 0 && sc.cellCount <= Board::CHUNK_SIZE * Board::CHUNK_SIZE, "invalid chunk");
+
+    auto cellIndices = r.skip(sc.cellCount, sizeof(uint16_t));
+    auto teams = r.skip(sc.cellCount, 1);
+
+    int x0 = (sc.index % board.chunksX) * Board::CHUNK_SIZE;
+    int y0 = (sc.index / board.chunksX) * Board::CHUNK_SIZE;
+
+    for(int k = 0; k < sc.cellCount; ++k)
+    {
+      uint16_t cell;
+      memcpy(&cell, cellIndices + k * sizeof cell, sizeof cell);
+
+      int x = x0 + cell % Board::CHUNK_SIZE;
+      int y = y0 + cell / Board::CHUNK_SIZE;
+      check(cell < Board::CHUNK_SIZE * Board::CHUNK_SIZE && x < width && y < height, "invalid cell");
+
+      board.set(x, y, teams[k]);
+    }
+  }
+
+  check(r.size == 0, "trailing data");
+
+  updateEntitiesHash(*this);
+
+  // the next draw repaints everything
+  drawnPixels = nullptr;
+}
+
+void Game::checkpoint()
+{
+  if(!saved.board)
+  {
+    saved.board = std::make_unique<Board>(width, height);
+    saved.obstacles = std::make_unique<Obstacles>(width, height);
+  }
+
+  for(int i = 0; i < board.chunksX * board.chunksY; ++i)
+    saved.board->copyChunk(board, i);
+
+  for(int i = 0; i < MAX_PLAYERS; ++i)
+  {
+    saved.bikes[i] = bikes[i];
+    saved.trails[i] = trails.segments(1 + i);
+  }
+
+  saved.frameCount = frameCount;
+  saved.rngState = rngState;
+  saved.gameIsOver = gameIsOver;
+  saved.gameOverDelay = gameOverDelay;
+  saved.entitiesHash = entitiesHash;
+
+  saved.obstacles->copyFrom(obstacles);
+  trails.markUnchanged();
+
+  for(auto index : dirtyChunks)
+    chunkIsDirty[index] = false;
+
+  dirtyChunks.clear();
+  drawnPixels = nullptr;
+}
+
+void Game::rollback()
+{
+  if(!saved.board)
+    throw std::runtime_error("Can't roll back: no checkpoint");
+
+  for(auto index : dirtyChunks)
+  {
+    board.copyChunk(*saved.board, index);
+    chunkIsDirty[index] = false;
+  }
+
+  dirtyChunks.clear();
+
+  for(int i = 0; i < MAX_PLAYERS; ++i)
+  {
+    bikes[i] = saved.bikes[i];
+    trails.restore(1 + i, saved.trails[i].data(), saved.trails[i].size());
+  }
+
+  frameCount = saved.frameCount;
+  rngState = saved.rngState;
+  gameIsOver = saved.gameIsOver;
+  gameOverDelay = saved.gameOverDelay;
+  entitiesHash = saved.entitiesHash;
+
+  obstacles.copyFrom(*saved.obstacles);
+
+  drawnPixels = nullptr;
+}
+
+uint64_t Game::getStateHash()
+{
+  return board.hash() ^ entitiesHash;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Display.
 // No SDL or I/O should appear here.
 
 namespace
 {
-void putPixel(int* pixels, int x, int y, int color)
+
+// Visible parts, in screen coordinates, of the toroidal span [pos, pos+len)
+// when the screen shows [viewport, viewport+screenSize) of the arena.
+int clipToScreen(int pos, int len, int viewport, int arenaSize, int screenSize, Span spans[2])
 {
-  x = (x + BOARD_WIDTH) % BOARD_WIDTH;
-  y = (y + BOARD_HEIGHT) % BOARD_HEIGHT;
+  int rel = (pos - viewport + arenaSize) % arenaSize;
+  int count = 0;
+
+  for(int start : { rel, rel - arenaSize })
+  {
+    int begin = max(start, 0);
+    int end = min(start + min(len, arenaSize), screenSize);
 
-  pixels[y * BOARD_WIDTH + x] = color;
+    if(begin < end)
+      spans[count++] = { begin, end };
+  }
+
+  return count;
 }
+
+// When the arena matches the screen, the terminal wraps heads around the
+// edges like the arena does. Otherwise, heads crossing the screen edge would
+// wrongly wrap: hide them instead.
+bool isHeadVisible(int pos, int arenaSize, int screenSize)
+{
+  if(arenaSize == screenSize)
+    return true;
+
+  return pos >= 2 && pos < min(arenaSize, screenSize) - 2;
+}
+
+// Paints the cells of the arena shown at [sx.begin, sx.end) x [sy.begin, sy.end) on screen.
+void drawCells(Game& game, int* pixels, Vec2 viewport, Span sx, Span sy)
+{
+  auto& board = game.board;
+
+  for(int row = sy.begin; row < sy.end; ++row)
+  {
+    auto line = pixels + row * BOARD_WIDTH;
+    int y = (viewport.y + row) % game.height;
+    int col = sx.begin;
+
+    while(col < sx.end)
+    {
+      // stay within one chunk
+      int x = (viewport.x + col) % game.width;
+      int n = min({ sx.end - col, Board::CHUNK_SIZE - (x & (Board::CHUNK_SIZE - 1)), game.width - x });
+
+      if(auto chunk = board.getChunk(x >> Board::CHUNK_BITS, y >> Board::CHUNK_BITS))
+      {
+        auto cells = &chunk->cells[Board::cellIndex(x, y)];
+
+        for(int i = 0; i < n; ++i)
+          line[col + i] = getColor(cells[i]);
+      }
+      else
+      {
+        fill(line + col, line + col + n, getColor(0));
+      }
+
+      col += n;
+    }
+  }
+}
+}
+
+// Calls func(rows) on horizontal stripes of the screen, in parallel if
+// the game has a thread pool and there's enough work.
+template<typename Func>
+void forEachStripe(Game& game, bool bigJob, Func func)
+{
+  auto const STRIPE_HEIGHT = 16;
+
+  if(!game.pool || !bigJob)
+    return func(Span { 0, BOARD_HEIGHT });
+
+  int stripeCount = (BOARD_HEIGHT + STRIPE_HEIGHT - 1) / STRIPE_HEIGHT;
+
+  auto job = [&] (int i)
+    {
+      func(Span { i * STRIPE_HEIGHT, min((i + 1) * STRIPE_HEIGHT, (int)BOARD_HEIGHT) });
+    };
+
+  game.pool->parallelFor(stripeCount, job);
+}
+
+Span intersect(Span a, Span b)
+{
+  return { max(a.begin, b.begin), min(a.end, b.end) };
 }
 
 void Game::draw(int* pixels)
 {
-  for(int row = 0; row < BOARD_HEIGHT; ++row)
+  auto viewport = computeViewport(bikes, width, height);
+
+  // the part of the arena that fits on screen
+  int visibleWidth = min(width, BOARD_WIDTH);
+  int visibleHeight = min(height, BOARD_HEIGHT);
+
+  if(pixels != drawnPixels || viewport != drawnViewport)
   {
-    for(int col = 0; col < BOARD_WIDTH; ++col)
+    auto repaint = [&] (Span rows)
+      {
+        auto visibleRows = intersect(rows, { 0, visibleHeight });
+
+        if(visibleRows.begin < visibleRows.end)
+          drawCells(*this, pixels, viewport, { 0, visibleWidth }, visibleRows);
+
+        for(int row = rows.begin; row < rows.end; ++row)
+        {
+          auto line = pixels + row * BOARD_WIDTH;
+
+          if(row >= visibleHeight)
+            fill(line, line + BOARD_WIDTH, 0);
+          else
+            fill(line + visibleWidth, line + BOARD_WIDTH, 0);
+        }
+      };
+
+    forEachStripe(*this, true, repaint);
+
+    drawnPixels = pixels;
+    drawnViewport = viewport;
+  }
+  else
+  {
+    dirtyAreas.clear();
+
+    for(auto index : dirtyChunks)
     {
-      int c = board[row * BOARD_WIDTH + col];
-      putPixel(pixels, col, row, getColor(c));
+      int x = (index % board.chunksX) * Board::CHUNK_SIZE;
+      int y = (index / board.chunksX) * Board::CHUNK_SIZE;
+
+      Span spansX[2], spansY[2];
+      int countX = clipToScreen(x, min(width - x, (int)Board::CHUNK_SIZE), viewport.x, width, visibleWidth, spansX);
+      int countY = clipToScreen(y, min(height - y, (int)Board::CHUNK_SIZE), viewport.y, height, visibleHeight, spansY);
+
+      for(int i = 0; i < countX; ++i)
+        for(int j = 0; j < countY; ++j)
+          dirtyAreas.push_back({ spansX[i], spansY[j] });
     }
+
+    auto repaint = [&] (Span rows)
+      {
+        for(auto& area : dirtyAreas)
+        {
+          auto areaRows = intersect(area.y, rows);
+
+          if(areaRows.begin < areaRows.end)
+            drawCells(*this, pixels, viewport, area.x, areaRows);
+        }
+      };
+
+    // a turn usually dirties a handful of chunks: not worth waking the pool
+    forEachStripe(*this, dirtyAreas.size() >= 64, repaint);
   }
 
-  for(auto& ob : obstacles)
-    terminal->drawObstacle(ob.pos, ob.size);
+  for(auto index : dirtyChunks)
+    chunkIsDirty[index] = false;
+
+  dirtyChunks.clear();
+
+  for(int k = 0; k < obstacles.size(); ++k)
+  {
+    Span spansX[2], spansY[2];
+    int countX = clipToScreen(obstacles.x[k], obstacles.w[k], viewport.x, width, visibleWidth, spansX);
+    int countY = clipToScreen(obstacles.y[k], obstacles.h[k], viewport.y, height, visibleHeight, spansY);
+
+    for(int i = 0; i < countX; ++i)
+      for(int j = 0; j < countY; ++j)
+      {
+        auto& sx = spansX[i];
+        auto& sy = spansY[j];
+        terminal->drawObstacle(Vec2 { sx.begin, sy.begin }, Vec2 { sx.end - sx.begin, sy.end - sy.begin });
+      }
+  }
 
   // Draw player status
   for(int i = 0; i < MAX_PLAYERS; ++i)
   {
     auto colorIndex = 1 + i;
-    auto color = getColor(colorIndex);
 
-    for(int col = 10; col < 20; ++col)
-      putPixel(pixels, col, 10 + i * 10 + 0, color);
+    terminal->drawBar(Vec2 { 10, 10 + i * 10 }, Vec2 { 10, 1 }, colorIndex);
 
     auto& bike = bikes[i];
 
-    if(bike.alive)
-      terminal->drawHead(bike.pos, colorIndex);
+    if(!bike.alive)
+      continue;
+
+    Vec2 pos;
+    pos.x = (bike.pos.x - viewport.x + width) % width;
+    pos.y = (bike.pos.y - viewport.y + height) % height;
+
+    if(isHeadVisible(pos.x, width, BOARD_WIDTH) && isHeadVisible(pos.y, height, BOARD_HEIGHT))
+      terminal->drawHead(pos, colorIndex);
   }
 }
-
@@ -1,11 +1,17 @@
 #pragma once
 
+#include <cstdint>
 #include <vector>
 #include <memory>
 using std::vector;
+
+struct Board;
 using std::unique_ptr;
 
 static auto const MAX_PLAYERS = 4;
+
+// Size of the screen. The arena can be larger (see GameConfig), the screen
+// then shows a viewport of it.
 static auto const BOARD_WIDTH = 1024;
 static auto const BOARD_HEIGHT = 768;
 
@@ -27,6 +33,8 @@ struct PlayerInput
 struct GameInput
 {
   bool quit, restart;
+  bool record;
+  bool turbo;
   PlayerInput players[MAX_PLAYERS];
 };
 
@@ -91,16 +99,19 @@ static const int getColor(int index)
   return c[index % 8];
 }
 
+// Draws the sprites over the board, in screen coordinates.
 struct ITerminal
 {
   virtual void drawHead(Vec2 pos, int colorIndex) = 0;
   virtual void drawObstacle(Vec2 pos, Vec2 size) = 0;
+  virtual void drawBar(Vec2 pos, Vec2 size, int colorIndex) = 0;
 };
 
 struct NullTerminal : ITerminal
 {
   void drawHead(Vec2 pos, int colorIndex) override {};
   void drawObstacle(Vec2 pos, Vec2 size) override {};
+  void drawBar(Vec2 pos, Vec2 size, int colorIndex) override {};
 };
 
 static NullTerminal nullTerminal;
@@ -123,12 +134,138 @@ struct Obstacle
   bool solid = false;
 };
 
+// Receives every change made to the board, e.g to broadcast it to spectators.
+struct ISpectator
+{
+  virtual ~ISpectator() = default;
+  virtual void onNewRound(int width, int height, int turnsPerSecond) = 0;
+  virtual void onCell(Vec2 pos, int team) = 0;
+  virtual void onErase(Vec2 pos, Vec2 size) = 0;
+  virtual void onFrame(int frameCount, Bike const* bikes, vector<Obstacle> const& obstacles) = 0;
+};
+
+struct NullSpectator : ISpectator
+{
+  void onNewRound(int, int, int) override {};
+  void onCell(Vec2, int) override {};
+  void onErase(Vec2, Vec2) override {};
+  void onFrame(int, Bike const*, vector<Obstacle> const&) override {};
+};
+
+static NullSpectator nullSpectator;
+
+// IGame::update is called at this rate.
+static auto const TICKS_PER_SECOND = 1000;
+
+struct GameConfig
+{
+  // arena size
+  int width = BOARD_WIDTH;
+  int height = BOARD_HEIGHT;
+
+  int turnsPerSecond = 200;
+
+  // Speed tiers, in cells per turn. Every cell crossed is tested and
+  // claimed: fast modes can play fewer turns per second.
+  int speed = 1;
+  int boostSpeed = 2;
+
+  // 0: between 1 and 3, at random
+  int obstacleCount = 0;
+
+  // obstacles layout and moves
+  unsigned seed = 0;
+
+  // Threads for the bulk passes (drawing, obstacle erases), which only pay
+  // off on big arenas. 0: one per core.
+  int threadCount = 1;
+};
+
+struct IGame;
+
+// Sees each turn of a round just before it's played, e.g to archive replays.
+struct ITurnListener
+{
+  virtual void onTurn(IGame& game, int frameCount, GameInput const& input) = 0;
+};
+
 struct IGame
 {
   virtual ~IGame() = default;
   virtual int update(GameInput input) = 0;
+
+  // Once the round is over, update() still waits a while before it
+  // returns 1, with nothing moving: the number of updates that remain
+  // before that one (0 while the round goes on). skipTicks() does what
+  // that many updates would, at once.
+  virtual int getIdleTicks() = 0;
+  virtual void skipTicks(int count) = 0;
+
+  // Starts a new round, with the obstacles layout of 'seed'. Cheap: the
+  // memory of the previous round is reused.
+  virtual void reset(unsigned seed) = 0;
+
   virtual void draw(int* pixels) = 0;
+
+  // Runs exactly one turn, whatever the turn rate.
+  virtual void oneTurn(GameInput input) = 0;
+  virtual bool isRoundOver() = 0; // less than two survivors
+  virtual int getFrameCount() = 0; // turns played this round
+  virtual GameConfig getConfig() = 0;
+  virtual Bike const* getBikes() = 0; // MAX_PLAYERS
+  virtual Board const& getBoard() = 0;
+
+  // Trail queries, in O(segments).
+  virtual int getTrailOwner(Vec2 pos) = 0; // team, or 0
+  virtual int getTrailLength(int team) = 0; // in cells
+
+  virtual void setTurnListener(ITurnListener* listener) = 0;
+
+  // The whole state of the round: after loadState, the game plays on
+  // exactly as the saved one did (given the same inputs).
+  // The state can only be loaded into a game of the same arena size.
+  // loadState throws if the data is truncated or corrupted: the game must
+  // then be reset.
+  virtual void saveState(vector<uint8_t>& out) = 0;
+  virtual void loadState(const uint8_t* data, size_t size) = 0;
+
+  // For scratch games, e.g a bot trying moves: rollback() brings the game
+  // back to the last checkpoint(), in O(chunks changed since). The game
+  // must not be reset in between.
+  virtual void checkpoint() = 0;
+  virtual void rollback() = 0;
+
+  // 64-bit hash of the same state, kept up to date as the game runs:
+  // reading it is O(1). Equal states have equal hashes, whatever the way
+  // they were reached (played, or loaded).
+  virtual uint64_t getStateHash() = 0;
 };
 
-unique_ptr<IGame> createGame(ITerminal* terminal, IEventSink* sink);
+unique_ptr<IGame> createGame(ITerminal* terminal, IEventSink* sink, ISpectator* spectator = &nullSpectator, GameConfig config = GameConfig());
+
+// Top-left corner of the part of the arena shown on screen.
+// When the arena is larger than the screen, it follows the first living bike.
+static Vec2 computeViewport(Bike const* bikes, int arenaWidth, int arenaHeight)
+{
+  Vec2 center = { BOARD_WIDTH / 2, BOARD_HEIGHT / 2 };
+
+  for(int i = 0; i < MAX_PLAYERS; ++i)
+  {
+    if(bikes[i].alive)
+    {
+      center = bikes[i].pos;
+      break;
+    }
+  }
+
+  Vec2 viewport {};
+
+  if(arenaWidth > BOARD_WIDTH)
+    viewport.x = (center.x - BOARD_WIDTH / 2 + arenaWidth) % arenaWidth;
+
+  if(arenaHeight > BOARD_HEIGHT)
+    viewport.y = (center.y - BOARD_HEIGHT / 2 + arenaHeight) % arenaHeight;
+
+  return viewport;
+}
 
@@ -1,5 +1,9 @@
 // Input side of the terminal.
 // Depends on game logic.
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
 #include <vector>
 #include "SDL.h"
 #include "input.h"
@@ -15,8 +19,32 @@ struct HumanWithAJoystick
   int bikeId; // associated bike in the game
 };
 
+enum class ScriptedKey
+{
+  Left,
+  Right,
+  Up,
+  Down,
+  Boost,
+  Restart,
+  Quit,
+};
+
+const char* const scriptedKeyNames[] = { "left", "right", "up", "down", "boost", "restart", "quit" };
+
+struct ScriptedEvent
+{
+  int tick;
+  int player;
+  ScriptedKey key;
+  bool isPressed;
+};
+
 static std::vector<HumanWithAJoystick> g_humans;
 static GameInput g_input {};
+static std::vector<ScriptedEvent> g_script;
+static int g_scriptPos = 0;
+static int g_tick = 0;
 
 template<typename T, typename Lambda>
 int indexOf(std::vector<T> const& array, Lambda predicate)
@@ -100,6 +128,12 @@ void processEvent(SDL_Event const& event, GameInput& input)
     case SDL_SCANCODE_ESCAPE:
       input.quit = true;
       return;
+    case SDL_SCANCODE_F12:
+      input.record = isPressed;
+      break;
+    case SDL_SCANCODE_TAB:
+      input.turbo = isPressed;
+      break;
     case SDL_SCANCODE_SPACE:
       input.restart = isPressed;
       break;
@@ -180,6 +214,36 @@ void processEvent(SDL_Event const& event, GameInput& input)
     printf("Unknown event: %d\n", event.type);
   }
 }
+
+void applyScriptedEvent(ScriptedEvent const& event, GameInput& input)
+{
+  auto& player = input.players[event.player];
+
+  switch(event.key)
+  {
+  case ScriptedKey::Left:
+    player.left = event.isPressed;
+    break;
+  case ScriptedKey::Right:
+    player.right = event.isPressed;
+    break;
+  case ScriptedKey::Up:
+    player.up = event.isPressed;
+    break;
+  case ScriptedKey::Down:
+    player.down = event.isPressed;
+    break;
+  case ScriptedKey::Boost:
+    player.boost = event.isPressed;
+    break;
+  case ScriptedKey::Restart:
+    input.restart = event.isPressed;
+    break;
+  case ScriptedKey::Quit:
+    input.quit = event.isPressed;
+    break;
+  }
+}
 }
 
 GameInput processInput()
@@ -189,9 +253,68 @@ GameInput processInput()
   while(SDL_PollEvent(&event))
     processEvent(event, g_input);
 
+  while(g_scriptPos < (int)g_script.size() && g_script[g_scriptPos].tick <= g_tick)
+    applyScriptedEvent(g_script[g_scriptPos++], g_input);
+
+  g_tick++;
+
   return g_input;
 }
 
+void loadInputScript(const char* path)
+{
+  auto fp = fopen(path, "r");
+
+  if(!fp)
+    throw std::runtime_error(std::string("Can't open input script: ") + path);
+
+  char line[256];
+  int lineNumber = 0;
+
+  while(fgets(line, sizeof line, fp))
+  {
+    ++lineNumber;
+
+    if(line[0] == '#' || line[strspn(line, " \t\r\n")] == 0)
+      continue;
+
+    ScriptedEvent event {};
+    char key[16];
+    int isPressed;
+
+    auto fail = [&] (std::string what)
+      {
+        fclose(fp);
+        throw std::runtime_error(std::string(path) + ":" + std::to_string(lineNumber) + ": " + what);
+      };
+
+    if(sscanf(line, "%d %d %15s %d", &event.tick, &event.player, key, &isPressed) != 4
+       || event.player < 0 || event.player >= MAX_PLAYERS)
+      fail("invalid event");
+
+    auto name = std::find_if(std::begin(scriptedKeyNames), std::end(scriptedKeyNames), [&] (const char* n) { return !strcmp(n, key); });
+
+    if(name == std::end(scriptedKeyNames))
+      fail(std::string("unknown key '") + key + "'");
+
+    event.key = (ScriptedKey)(name - std::begin(scriptedKeyNames));
+
+    event.isPressed = isPressed;
+    g_script.push_back(event);
+  }
+
+  fclose(fp);
+
+  auto byTick = [] (ScriptedEvent const& a, ScriptedEvent const& b) { return a.tick < b.tick; };
+  std::stable_sort(g_script.begin(), g_script.end(), byTick);
+  g_scriptPos = 0;
+}
+
+int getJoystickCount()
+{
+  return g_humans.size();
+}
+
 void destroyInput()
 {
   while(!g_humans.empty())
@@ -5,3 +5,11 @@
 GameInput processInput();
 void destroyInput();
 
+// Joysticks currently plugged in, and assigned to a bike.
+int getJoystickCount();
+
+// Replays scripted key presses on top of the real input, e.g for CI runs.
+// One event per line: "<tick> <player> <left|right|up|down|boost|restart|quit> <0|1>".
+// A tick is one call to processInput.
+void loadInputScript(const char* path);
+
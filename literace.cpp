@@ -0,0 +1,233 @@
+// libliterace: batches of headless games, behind a C API.
+#include "literace.h"
+#include "analytics.h"
+#include "game.h"
+#include "observe.h"
+#include "threadpool.h"
+#include <cstdio>
+#include <stdexcept>
+
+static_assert(LITERACE_MAX_PLAYERS == MAX_PLAYERS, "LITERACE_MAX_PLAYERS must match the game");
+
+namespace
+{
+auto const OBSERVATION_SIZE = MAX_PLAYERS * LITERACE_BIKE_OBSERVATION_SIZE;
+
+struct Env : IEventSink
+{
+  void onRoundFinished() override {};
+  void onTurn(int, int) override {};
+
+  void onKilled(int, int victim, int killer) override
+  {
+    rewards[victim - 1] -= 1;
+
+    if(killer != victim)
+      rewards[killer - 1] += 1;
+  }
+
+  void onCrash(int, vector<int> victims) override
+  {
+    for(auto victim : victims)
+      rewards[victim] -= 1;
+  }
+
+  void reset()
+  {
+    if(game && analytics && game->isRoundOver())
+      analytics->writeRound(*game, stats);
+
+    stats.clear();
+
+    if(game)
+    {
+      game->reset(seed++);
+      return;
+    }
+
+    GameConfig config;
+    config.width = width;
+    config.height = height;
+    config.seed = seed++;
+    game = createGame(&nullTerminal, &stats, &nullSpectator, config);
+  }
+
+  void observe(int32_t* obs)
+  {
+    auto bikes = game->getBikes();
+
+    for(int i = 0; i < MAX_PLAYERS; ++i)
+    {
+      *obs++ = bikes[i].pos.x;
+      *obs++ = bikes[i].pos.y;
+      *obs++ = (int)bikes[i].direction;
+      *obs++ = bikes[i].alive;
+    }
+  }
+
+  int width, height;
+  unsigned seed;
+  unique_ptr<IGame> game;
+  float* rewards;
+  RoundStats stats { this };
+  IAnalyticsWriter* analytics = nullptr;
+};
+
+PlayerInput toPlayerInput(uint8_t action)
+{
+  PlayerInput input {};
+  auto direction = (Direction)(action & 7);
+  input.left = direction == Direction::Left;
+  input.down = direction == Direction::Down;
+  input.right = direction == Direction::Right;
+  input.up = direction == Direction::Up;
+  input.boost = action & LITERACE_ACTION_BOOST;
+  return input;
+}
+}
+
+struct LiteraceBatch
+{
+  LiteraceBatch(int threadCount) : pool(threadCount)
+  {
+  }
+
+  vector<Env> envs;
+  ThreadPool pool;
+  unique_ptr<IAnalyticsWriter> analytics;
+};
+
+LiteraceBatch* literaceCreate(int gameCount, int width, int height, unsigned seed, int threadCount)
+{
+  if(gameCount < 1 || width < 1 || height < 1 || threadCount < 0)
+  {
+    fprintf(stderr, "[literace] invalid batch: %d games of %dx%d, %d threads\n", gameCount, width, height, threadCount);
+    return nullptr;
+  }
+
+  auto batch = new LiteraceBatch(threadCount);
+  batch->envs.resize(gameCount);
+
+  for(int i = 0; i < gameCount; ++i)
+  {
+    auto& env = batch->envs[i];
+    env.width = width;
+    env.height = height;
+    env.seed = seed + i * 0x10000; // distinct sequences of rounds
+    env.reset();
+  }
+
+  return batch;
+}
+
+void literaceDestroy(LiteraceBatch* batch)
+{
+  delete batch;
+}
+
+void literaceReset(LiteraceBatch* batch, int32_t* observations)
+{
+  auto job = [&] (int i)
+    {
+      auto& env = batch->envs[i];
+      env.reset();
+      env.observe(observations + i * OBSERVATION_SIZE);
+    };
+
+  batch->pool.parallelFor(batch->envs.size(), job);
+}
+
+void literaceStep(LiteraceBatch* batch, const uint8_t* actions, float* rewards, uint8_t* dones, int32_t* observations)
+{
+  auto job = [&] (int i)
+    {
+      auto& env = batch->envs[i];
+
+      GameInput input {};
+
+      for(int k = 0; k < MAX_PLAYERS; ++k)
+      {
+        input.players[k] = toPlayerInput(actions[i * MAX_PLAYERS + k]);
+        rewards[i * MAX_PLAYERS + k] = 0;
+      }
+
+      env.rewards = rewards + i * MAX_PLAYERS;
+      env.game->oneTurn(input);
+
+      dones[i] = env.game->isRoundOver();
+
+      if(dones[i])
+        env.reset();
+
+      env.observe(observations + i * OBSERVATION_SIZE);
+    };
+
+  batch->pool.parallelFor(batch->envs.size(), job);
+}
+
+
+void literaceObserveViews(LiteraceBatch* batch, int size, uint8_t* views)
+{
+  auto job = [&] (int i)
+    {
+      auto& game = *batch->envs[i].game;
+      auto bikes = game.getBikes();
+
+      for(int k = 0; k < MAX_PLAYERS; ++k)
+      {
+        auto out = views + (i * MAX_PLAYERS + k) * size * size;
+        extractView(game.getBoard(), bikes[k].pos, bikes[k].direction, size, out);
+      }
+    };
+
+  batch->pool.parallelFor(batch->envs.size(), job);
+}
+
+int literacePyramidSize(LiteraceBatch* batch, int levels)
+{
+  if(levels < 1)
+    return -1;
+
+  auto& board = batch->envs[0].game->getBoard();
+  return pyramidSize(board.width, board.height, levels);
+}
+
+void literaceObservePyramids(LiteraceBatch* batch, int levels, uint8_t* pyramids)
+{
+  int size = literacePyramidSize(batch, levels);
+
+  if(size < 0)
+    return;
+
+  auto job = [&] (int i)
+    {
+      extractPyramid(batch->envs[i].game->getBoard(), levels, pyramids + i * size);
+    };
+
+  batch->pool.parallelFor(batch->envs.size(), job);
+}
+
+void literaceStateHashes(LiteraceBatch* batch, uint64_t* hashes)
+{
+  for(int i = 0; i < (int)batch->envs.size(); ++i)
+    hashes[i] = batch->envs[i].game->getStateHash();
+}
+
+int literaceOpenAnalytics(LiteraceBatch* batch, const char* path)
+{
+  try
+  {
+    auto analytics = createAnalyticsWriter(path);
+
+    for(auto& env : batch->envs)
+      env.analytics = analytics.get();
+
+    batch->analytics = move(analytics);
+    return 0;
+  }
+  catch(std::exception const& e)
+  {
+    fprintf(stderr, "[literace] %s\n", e.what());
+    return -1;
+  }
+}
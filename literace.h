@@ -0,0 +1,73 @@
+/*
+ * libliterace: C API to run batches of games, e.g as reinforcement
+ * learning environments.
+ *
+ * All the games of a batch are stepped in one call, on a pool of threads.
+ * Results are written into caller-owned contiguous buffers: no allocation
+ * happens per step.
+ * A game whose round is over is reset on the spot: the observation returned
+ * for it is then the first one of the next round.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LITERACE_MAX_PLAYERS 4
+
+/* Per bike: x, y, direction (1: left, 2: down, 3: right, 4: up), alive. */
+#define LITERACE_BIKE_OBSERVATION_SIZE 4
+
+/* Actions, one byte per bike: a direction (0: keep going), plus the boost flag. */
+#define LITERACE_ACTION_BOOST 8
+
+typedef struct LiteraceBatch LiteraceBatch;
+
+/* 'threadCount' == 0 means one thread per core.
+ * Returns NULL if an argument is invalid: the batch needs at least one game,
+ * and the arena at least one cell. */
+LiteraceBatch* literaceCreate(int gameCount, int width, int height, unsigned seed, int threadCount);
+void literaceDestroy(LiteraceBatch* batch);
+
+/* Starts a new round in every game.
+ * observations: gameCount * LITERACE_MAX_PLAYERS * LITERACE_BIKE_OBSERVATION_SIZE */
+void literaceReset(LiteraceBatch* batch, int32_t* observations);
+
+/* Runs one turn of every game.
+ * actions: gameCount * LITERACE_MAX_PLAYERS
+ * rewards: gameCount * LITERACE_MAX_PLAYERS (+1 per kill, -1 on death)
+ * dones: gameCount
+ * observations: as for literaceReset */
+void literaceStep(LiteraceBatch* batch, const uint8_t* actions, float* rewards, uint8_t* dones, int32_t* observations);
+
+/* Egocentric views: for each game and bike, a size x size crop of the board
+ * centered on the bike, and rotated so that the bike faces up.
+ * Cells hold the team (1-4), or 0 when empty.
+ * views: gameCount * LITERACE_MAX_PLAYERS * size * size */
+void literaceObserveViews(LiteraceBatch* batch, int size, uint8_t* views);
+
+/* Occupancy pyramids of the whole boards: level 0 has one byte per cell
+ * (0: empty, 255: taken), each next level halves both dimensions and holds
+ * the average of 2x2 cells. 'levels' must be at least 1: otherwise
+ * literacePyramidSize returns -1, and nothing is written.
+ * pyramids: gameCount * literacePyramidSize(batch, levels) */
+int literacePyramidSize(LiteraceBatch* batch, int levels);
+void literaceObservePyramids(LiteraceBatch* batch, int levels, uint8_t* pyramids);
+
+/* 64-bit hashes of the states of the games, e.g to check that two runs
+ * stay in sync. Cheap: the hashes are kept up to date as the games run.
+ * hashes: gameCount */
+void literaceStateHashes(LiteraceBatch* batch, uint64_t* hashes);
+
+/* Appends the metrics of every finished round to an analytics file (see
+ * analytics.h, and stats.exe to aggregate it), until the batch is
+ * destroyed. Returns 0 on success, -1 if the file can't be opened. */
+int literaceOpenAnalytics(LiteraceBatch* batch, const char* path);
+
+#ifdef __cplusplus
+}
+#endif
+
@@ -0,0 +1,335 @@
+// Load generator for the dedicated server: simulates many players over UDP.
+// Usage: loadgen.exe [--server <host>:<port>] [--players <count>] [--seconds <duration>]
+//
+// Each player has its own socket: it joins, then answers each state with
+// its input, and turns at random now and then. Prints what the players
+// received, once per second.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "netproto.h"
+
+using namespace std;
+
+namespace
+{
+// A join without an answer is sent again after this.
+auto const JOIN_RETRY_MS = 500;
+
+int64_t nowMs()
+{
+  using namespace chrono;
+  return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+sockaddr_in resolve(string hostAndPort)
+{
+  auto colon = hostAndPort.rfind(':');
+
+  if(colon == string::npos)
+    throw runtime_error("Invalid server address: '" + hostAndPort + "'");
+
+  auto host = hostAndPort.substr(0, colon);
+  auto port = hostAndPort.substr(colon + 1);
+
+  addrinfo hints {};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+
+  addrinfo* addr = nullptr;
+
+  if(getaddrinfo(host.c_str(), port.c_str(), &hints, &addr))
+    throw runtime_error("Can't resolve '" + host + "'");
+
+  auto r = *(sockaddr_in*)addr->ai_addr;
+  freeaddrinfo(addr);
+  return r;
+}
+
+enum class PlayerState
+{
+  Joining,
+  Playing,
+  Refused,
+};
+
+struct Player
+{
+  int fd;
+  PlayerState state = PlayerState::Joining;
+  sockaddr_in shard {}; // where the inputs go: the sender of the welcome
+  int64_t joinSentAt = 0;
+  int64_t firstJoinAt = 0;
+  uint32_t lastFrame = 0;
+  int keys = 0;
+};
+
+struct Stats
+{
+  int64_t states = 0;
+  int64_t bytes = 0;
+  int64_t lost = 0; // states never received
+  int64_t rounds = 0;
+  int64_t cells = 0;
+  int64_t joins = 0;
+  int64_t joinTimeMs = 0;
+  int64_t refused = 0;
+  int64_t malformed = 0;
+};
+
+struct LoadGenerator
+{
+  LoadGenerator(sockaddr_in server_, int playerCount) : server(server_)
+  {
+    epfd = epoll_create1(0);
+
+    for(int i = 0; i < playerCount; ++i)
+    {
+      Player player;
+      player.fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+
+      if(player.fd < 0)
+        throw runtime_error("Can't create socket for player " + to_string(i));
+
+      epoll_event ev {};
+      ev.events = EPOLLIN;
+      ev.data.u32 = i;
+      epoll_ctl(epfd, EPOLL_CTL_ADD, player.fd, &ev);
+
+      players.push_back(player);
+    }
+  }
+
+  ~LoadGenerator()
+  {
+    NetWriter w;
+    w.u8(NET_LEAVE);
+
+    for(auto& player : players)
+    {
+      if(player.state == PlayerState::Playing)
+        send(player, player.shard, w);
+
+      close(player.fd);
+    }
+
+    close(epfd);
+  }
+
+  void send(Player& player, sockaddr_in const& to, NetWriter const& w)
+  {
+    sendto(player.fd, w.data.data(), w.data.size(), 0, (sockaddr*)&to, sizeof to);
+  }
+
+  void sendJoins()
+  {
+    auto now = nowMs();
+    NetWriter w;
+    w.u8(NET_JOIN);
+
+    for(auto& player : players)
+    {
+      if(player.state != PlayerState::Joining || now - player.joinSentAt < JOIN_RETRY_MS)
+        continue;
+
+      if(!player.firstJoinAt)
+        player.firstJoinAt = now;
+
+      player.joinSentAt = now;
+      send(player, server, w);
+    }
+  }
+
+  void run(int64_t durationMs)
+  {
+    auto end = nowMs() + durationMs;
+    auto nextReport = nowMs() + 1000;
+    Stats last;
+
+    while(nowMs() < end)
+    {
+      sendJoins();
+
+      epoll_event events[256];
+      int count = epoll_wait(epfd, events, 256, 50);
+
+      for(int i = 0; i < count; ++i)
+        receive(players[events[i].data.u32]);
+
+      if(nowMs() >= nextReport)
+      {
+        report(stats, last, "");
+        last = stats;
+        nextReport += 1000;
+      }
+    }
+
+    report(stats, Stats(), "total: ");
+  }
+
+  void receive(Player& player)
+  {
+    uint8_t buffer[NET_MAX_PACKET];
+    sockaddr_in from;
+    socklen_t fromSize = sizeof from;
+    int size;
+
+    while((size = recvfrom(player.fd, buffer, sizeof buffer, 0, (sockaddr*)&from, &fromSize)) > 0)
+    {
+      NetReader r(buffer, size);
+      stats.bytes += size;
+
+      switch(r.u8())
+      {
+      case NET_WELCOME:
+        if(player.state == PlayerState::Joining)
+        {
+          player.state = PlayerState::Playing;
+          player.shard = from;
+          stats.joins++;
+          stats.joinTimeMs += nowMs() - player.firstJoinAt;
+        }
+
+        break;
+      case NET_FULL:
+        if(player.state == PlayerState::Joining)
+        {
+          player.state = PlayerState::Refused;
+          stats.refused++;
+        }
+
+        break;
+      case NET_STATE:
+        onState(player, r);
+        break;
+      }
+
+      fromSize = sizeof from;
+    }
+  }
+
+  void onState(Player& player, NetReader& r)
+  {
+    r.u32(); // match
+    auto frameCount = r.u32();
+
+    for(int i = 0; i < MAX_PLAYERS; ++i)
+    {
+      r.u8();
+      r.u16();
+      r.u16();
+      r.u8();
+    }
+
+    int obstacleCount = r.u16();
+
+    for(int i = 0; i < obstacleCount * 4; ++i)
+      r.u16();
+
+    int cellCount = r.u16();
+
+    for(int i = 0; i < cellCount; ++i)
+    {
+      r.u16();
+      r.u16();
+      r.u8();
+    }
+
+    if(!r.ok)
+    {
+      stats.malformed++;
+      return;
+    }
+
+    stats.states++;
+    stats.cells += cellCount;
+
+    if(frameCount <= player.lastFrame)
+      stats.rounds++;
+    else if(player.lastFrame)
+      stats.lost += frameCount - player.lastFrame - 1;
+
+    player.lastFrame = frameCount;
+
+    // a new direction, now and then
+    if(rand() % 64 == 0)
+      player.keys = 1 << (rand() % 4) | (rand() % 8 == 0 ? 16 : 0);
+
+    NetWriter w;
+    w.u8(NET_INPUT);
+    w.u8(player.keys);
+    send(player, player.shard, w);
+  }
+
+  void report(Stats const& now, Stats const& before, const char* prefix)
+  {
+    auto states = now.states - before.states;
+    auto lost = now.lost - before.lost;
+
+    printf("[loadgen] %s%lld/%d players in, %lld refused, %lld states (%.2f%% lost), %.0f kB, %lld rounds, %lld malformed",
+           prefix, (long long)now.joins, (int)players.size(), (long long)now.refused,
+           (long long)states, states + lost ? lost * 100.0 / (states + lost) : 0.0,
+           (now.bytes - before.bytes) / 1000.0, (long long)(now.rounds - before.rounds), (long long)(now.malformed - before.malformed));
+
+    if(now.joins)
+      printf(", join in %.1f ms", now.joinTimeMs / (double)now.joins);
+
+    printf("\n");
+    fflush(stdout);
+  }
+
+  const sockaddr_in server;
+  int epfd;
+  vector<Player> players;
+  Stats stats;
+};
+}
+
+int main(int argc, char* argv[])
+{
+  string server = "127.0.0.1:" + to_string(NET_DEFAULT_PORT);
+  int playerCount = 200;
+  int seconds = 10;
+
+  for(int i = 1; i < argc; ++i)
+  {
+    string arg = argv[i];
+
+    if(arg == "--server" && i + 1 < argc)
+      server = argv[++i];
+    else if(arg == "--players" && i + 1 < argc)
+      playerCount = max(1, atoi(argv[++i]));
+    else if(arg == "--seconds" && i + 1 < argc)
+      seconds = max(1, atoi(argv[++i]));
+    else
+    {
+      fprintf(stderr, "Usage: %s [--server <host>:<port>] [--players <count>] [--seconds <duration>]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  try
+  {
+    LoadGenerator generator(resolve(server), playerCount);
+    generator.run(seconds * 1000LL);
+  }
+  catch(exception const& e)
+  {
+    fprintf(stderr, "Fatal: %s\n", e.what());
+    return 1;
+  }
+
+  return 0;
+}
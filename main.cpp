@@ -1,52 +1,26 @@
 // "Terminal" side.
+#include <csignal>
 #include <cstdio>
 #include <cassert>
+#include <stdexcept>
 #include <vector>
 #include <algorithm>
+#include <string>
 #include "SDL.h"
+#include "analytics.h"
+#include "archive.h"
 #include "audio.h"
+#include "bot.h"
 #include "display.h"
 #include "input.h"
 #include "game.h"
+#include "metrics.h"
 #include "scene.h"
+#include "spectator.h"
+#include "terminal.h"
 
 using namespace std;
 
-struct Terminal : ITerminal
-{
-  void drawHead(Vec2 pos, int colorIndex) override
-  {
-    for(int j = -2; j <= 2; ++j)
-      for(int k = -2; k <= 2; ++k)
-        putPixel(pixels, pos.x - k, pos.y - j, darken(getColor(colorIndex)));
-  }
-
-  void drawObstacle(Vec2 pos, Vec2 size) override
-  {
-    for(int y = 0; y < size.y; ++y)
-      for(int x = 0; x < size.x; ++x)
-        putPixel(pixels, pos.x + x, pos.y + y, -1);
-  }
-
-  static int darken(int color)
-  {
-    int r = (color >> 16) & 0xff;
-    int g = (color >> 8) & 0xff;
-    int b = (color >> 0) & 0xff;
-    return mkColor(r / 2, g / 2, b / 2);
-  }
-
-  static void putPixel(Uint32* pixels, int x, int y, int color)
-  {
-    x = (x + BOARD_WIDTH) % BOARD_WIDTH;
-    y = (y + BOARD_HEIGHT) % BOARD_HEIGHT;
-
-    pixels[y * BOARD_WIDTH + x] = color;
-  }
-
-  Uint32 pixels[BOARD_WIDTH * BOARD_HEIGHT];
-};
-
 struct Match : IEventSink
 {
   void onRoundFinished() override
@@ -61,6 +35,8 @@ struct Match : IEventSink
 
   void onKilled(int frameCount, int victim, int killer) override
   {
+    audio->play(Sound::Crash, time);
+
     if(victim == killer)
     {
       printf("Bike %d committed suicide (lifetime=%d)\n", victim, frameCount);
@@ -75,12 +51,16 @@ struct Match : IEventSink
 
   void onTurn(int frameCount, int bike) override
   {
+    audio->play(Sound::Turn, time);
+
     if(0)
       printf("bike %d turned\n", bike);
   }
 
   void onCrash(int frameCount, vector<int> victims) override
   {
+    audio->play(Sound::Crash, time);
+
     printf("crash! victims:");
 
     for(auto victim : victims)
@@ -90,20 +70,53 @@ struct Match : IEventSink
   }
 
   int kills[MAX_PLAYERS] {};
+  int round = 0; // 1 for the first one
+  uint64_t turnCount = 0; // over all the rounds
+
+  // the sounds are stamped with the game time of the tick that caused them
+  IAudio* audio = nullptr;
+  double time = 0; // in seconds
 };
 
-static auto const TIMESTEP_MS = 1;
+static auto const TIMESTEP_MS = 1000 / TICKS_PER_SECOND;
+
+// In turbo mode, the game runs as fast as possible, and a frame is shown
+// at this interval.
+static auto const TURBO_FRAME_MS = 16;
+
+// A static scene isn't redrawn, but for a refresh at this interval (e.g
+// after the window was uncovered).
+static auto const IDLE_REFRESH_MS = 500;
+
+// In headless mode, time is simulated: each frame advances the clock by this.
+static auto const HEADLESS_FRAME_MS = 16;
 
 struct PlayingScene : IScene
 {
-  PlayingScene(Terminal* terminal_, Match* match_) : m_match(match_)
+  PlayingScene(Match* match_, IGame* game_, IBot* bot_, int botCount_) : m_match(match_), m_game(game_), m_bot(bot_), m_botCount(botCount_)
   {
-    m_game = createGame(terminal_, match_);
   }
 
   IScene* update(GameInput input) override
   {
+    // the bots take the last seats, and think once per turn
+    if(m_bot)
+    {
+      if(m_decidedAt != m_game->getFrameCount())
+      {
+        m_decidedAt = m_game->getFrameCount();
+
+        for(int i = MAX_PLAYERS - m_botCount; i < MAX_PLAYERS; ++i)
+          m_moves[i] = m_bot->play(*m_game, i);
+      }
+
+      for(int i = MAX_PLAYERS - m_botCount; i < MAX_PLAYERS; ++i)
+        input.players[i] = m_moves[i];
+    }
+
+    int turnsBefore = m_game->getFrameCount();
     int ret = m_game->update(input);
+    m_match->turnCount += m_game->getFrameCount() - turnsBefore;
     std::vector<int> scores;
 
     for(auto& score : m_match->kills)
@@ -117,8 +130,28 @@ struct PlayingScene : IScene
     m_game->draw(pixels);
   }
 
+  const char* name() override
+  {
+    return "playing";
+  }
+
+  // the end of the round: nothing moves until the scores
+  int idleTicks() override
+  {
+    return m_game->getIdleTicks();
+  }
+
+  void skip(int ticks) override
+  {
+    m_game->skipTicks(ticks);
+  }
+
   Match* const m_match;
-  std::unique_ptr<IGame> m_game;
+  IGame* const m_game;
+  IBot* const m_bot;
+  const int m_botCount;
+  int m_decidedAt = -1;
+  PlayerInput m_moves[MAX_PLAYERS] {};
 };
 
 struct ScoreScene : IScene
@@ -150,30 +183,333 @@ struct ScoreScene : IScene
     }
   }
 
+  const char* name() override
+  {
+    return "scores";
+  }
+
+  int idleTicks() override
+  {
+    return max(0, timer - 1);
+  }
+
+  void skip(int ticks) override
+  {
+    timer -= ticks;
+  }
+
   ITerminal* const terminal;
   const std::vector<int> scores;
 };
 
-int main()
+// For the options that open something: prints why it failed, if it did.
+template<typename Open>
+bool tryOpen(Open open)
 {
-  SDL_Init(SDL_INIT_EVERYTHING);
+  try
+  {
+    open();
+    return true;
+  }
+  catch(exception const& e)
+  {
+    fprintf(stderr, "%s\n", e.what());
+    return false;
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  // a spectator reading from a pipe can go away: the writes fail instead
+  signal(SIGPIPE, SIG_IGN);
+
+  unique_ptr<ISpectator> spectator;
+  unique_ptr<IReplayWriter> archive;
+  unique_ptr<IAnalyticsWriter> analytics;
+  string captureDir = "capture";
+  string metricsName; // empty: not published
+  bool recording = false;
+  bool headless = false;
+  bool turbo = false;
+  int maxFrames = 0;
+  GameConfig config;
+  DisplayConfig displayConfig;
+  int threadCount = -1; // auto
+  int botCount = 0;
+  AudioConfig audioConfig;
+
+  for(int i = 1; i < argc; ++i)
+  {
+    string arg = argv[i];
+
+    if(arg == "--spectate" && i + 1 < argc)
+    {
+      if(!tryOpen([&] { spectator = createSpectatorStream(argv[++i]); }))
+        return 1;
+    }
+    else if(arg == "--archive" && i + 1 < argc)
+    {
+      if(!tryOpen([&] { archive = createReplayWriter(argv[++i]); }))
+        return 1;
+    }
+    else if(arg == "--analytics" && i + 1 < argc)
+    {
+      if(!tryOpen([&] { analytics = createAnalyticsWriter(argv[++i]); }))
+        return 1;
+    }
+    else if(arg == "--metrics" && i + 1 < argc)
+    {
+      metricsName = argv[++i];
+    }
+    else if(arg == "--record" && i + 1 < argc)
+    {
+      captureDir = argv[++i];
+      recording = true;
+    }
+    else if(arg == "--arena" && i + 1 < argc)
+    {
+      if(sscanf(argv[++i], "%dx%d", &config.width, &config.height) != 2 || config.width < 1 || config.height < 1)
+      {
+        fprintf(stderr, "Invalid arena size: '%s'\n", argv[i]);
+        return 1;
+      }
+    }
+    else if(arg == "--rate" && i + 1 < argc)
+    {
+      config.turnsPerSecond = atoi(argv[++i]);
+
+      if(config.turnsPerSecond < 1)
+      {
+        fprintf(stderr, "Invalid turn rate: '%s'\n", argv[i]);
+        return 1;
+      }
+    }
+    else if(arg == "--speed" && i + 1 < argc)
+    {
+      // the boost keeps doubling the speed
+      config.speed = atoi(argv[++i]);
+      config.boostSpeed = config.speed * 2;
+
+      if(config.speed < 1)
+      {
+        fprintf(stderr, "Invalid speed: '%s'\n", argv[i]);
+        return 1;
+      }
+    }
+    else if(arg == "--obstacles" && i + 1 < argc)
+    {
+      config.obstacleCount = atoi(argv[++i]);
+
+      if(config.obstacleCount < 1)
+      {
+        fprintf(stderr, "Invalid obstacle count: '%s'\n", argv[i]);
+        return 1;
+      }
+    }
+    else if(arg == "--threads" && i + 1 < argc)
+    {
+      threadCount = atoi(argv[++i]);
+
+      if(threadCount < 0)
+      {
+        fprintf(stderr, "Invalid thread count: '%s'\n", argv[i]);
+        return 1;
+      }
+    }
+    else if(arg == "--bots" && i + 1 < argc)
+    {
+      botCount = atoi(argv[++i]);
+
+      if(botCount < 0 || botCount > MAX_PLAYERS)
+      {
+        fprintf(stderr, "Invalid bot count: '%s'\n", argv[i]);
+        return 1;
+      }
+    }
+    else if(arg == "--audio-buffer" && i + 1 < argc)
+    {
+      audioConfig.bufferFrames = atoi(argv[++i]);
+
+      // SDL wants a power of two
+      if(audioConfig.bufferFrames < 64 || audioConfig.bufferFrames > 8192 || (audioConfig.bufferFrames & (audioConfig.bufferFrames - 1)))
+      {
+        fprintf(stderr, "Invalid audio buffer size: '%s'\n", argv[i]);
+        return 1;
+      }
+    }
+    else if(arg == "--scale" && i + 1 < argc)
+    {
+      displayConfig.scale = atoi(argv[++i]);
+
+      if(displayConfig.scale < 1)
+      {
+        fprintf(stderr, "Invalid scale: '%s'\n", argv[i]);
+        return 1;
+      }
+    }
+    else if(arg == "--fullscreen")
+    {
+      displayConfig.fullscreen = true;
+    }
+    else if(arg == "--post" && i + 1 < argc)
+    {
+      string quality = argv[++i];
+
+      if(quality == "off")
+        displayConfig.postProcess = PostProcess::Off;
+      else if(quality == "low")
+        displayConfig.postProcess = PostProcess::Low;
+      else if(quality == "high")
+        displayConfig.postProcess = PostProcess::High;
+      else
+      {
+        fprintf(stderr, "Invalid post-process quality: '%s'\n", argv[i]);
+        return 1;
+      }
+    }
+    else if(arg == "--turbo")
+    {
+      turbo = true;
+    }
+    else if(arg == "--headless")
+    {
+      headless = true;
+    }
+    else if(arg == "--frames" && i + 1 < argc)
+    {
+      maxFrames = atoi(argv[++i]);
+    }
+    else if(arg == "--input-script" && i + 1 < argc)
+    {
+      if(!tryOpen([&] { loadInputScript(argv[++i]); }))
+        return 1;
+    }
+    else
+    {
+      fprintf(stderr, "Usage: %s [--spectate <file|-|tcp:host:port>] [--record <dir>] [--archive <file>] [--analytics <file>]\n", argv[0]);
+      fprintf(stderr, "          [--metrics <name>]\n");
+      fprintf(stderr, "          [--arena <width>x<height>] [--rate <turns/s>] [--speed <cells/turn>] [--obstacles <count>] [--threads <count>]\n");
+      fprintf(stderr, "          [--bots <count>] [--audio-buffer <samples>]\n");
+      fprintf(stderr, "          [--scale <n>] [--fullscreen] [--post off|low|high]\n");
+      fprintf(stderr, "          [--turbo] [--headless] [--frames <count>] [--input-script <file>]\n");
+      return 1;
+    }
+  }
+
+  // the screen only scrolls over arenas bigger than itself: then it's
+  // repainted on every frame, which is worth spreading over the cores
+  if(threadCount < 0)
+    threadCount = config.width > BOARD_WIDTH || config.height > BOARD_HEIGHT ? 0 : 1;
+
+  config.threadCount = threadCount;
+
+  // the bots share half of each turn
+  unique_ptr<IBot> bot;
+
+  if(botCount)
+  {
+    BotConfig botConfig;
+    botConfig.budgetUs = min(botConfig.budgetUs, 500000 / (config.turnsPerSecond * botCount));
+    bot = createRolloutBot(botConfig);
+  }
+
+  auto startTime = SDL_GetPerformanceCounter();
+
+  // only what's used: the audio comes up in the background
+  SDL_Init(headless ? SDL_INIT_EVENTS : SDL_INIT_VIDEO | SDL_INIT_JOYSTICK);
+
+  auto display = createDisplay(BOARD_WIDTH, BOARD_HEIGHT, headless, displayConfig);
+  unique_ptr<IAudio> audio;
+
+  if(headless)
+    audio = make_unique<NullAudio>();
+  else
+    audio = createAudio(audioConfig);
 
-  auto display = createDisplay(BOARD_WIDTH, BOARD_HEIGHT);
-  auto audio = createAudio();
+  // F12 starts/stops recording, each take goes to its own directory
+  int takeCount = 0;
+  bool recordWasPressed = false;
+
+  auto startStopRecording = [&] ()
+    {
+      if(!recording)
+        return display->setCapture(nullptr);
+
+      auto takeDir = captureDir + "/take-" + to_string(++takeCount);
+      display->setCapture(takeDir.c_str());
+    };
+
+  if(recording)
+    startStopRecording();
+
+  // live health counters, for monitoring tools (see monitor.cpp)
+  unique_ptr<IMetricsPublisher> metrics;
+
+  if(!metricsName.empty())
+  {
+    try
+    {
+      metrics = createMetricsPublisher(metricsName.c_str());
+    }
+    catch(exception const& e)
+    {
+      printf("[metrics] %s\n", e.what());
+    }
+  }
 
   struct App : ISceneFactory
   {
     Terminal terminal;
     Match match;
+    ISpectator* spectator = &nullSpectator;
+    ITurnListener* turnListener = nullptr;
+    IAnalyticsWriter* analytics = nullptr;
+    IBot* bot = nullptr;
+    int botCount = 0;
+    RoundStats roundStats { &match };
+    GameConfig config;
+
+    // One game for all the rounds: the next one is set up while the
+    // scores are shown.
+    unique_ptr<IGame> game;
+    bool nextRoundIsReady = false;
+
+    void prepareNextRound()
+    {
+      config.seed = rand(); // a new obstacles layout each round
+      roundStats.clear();
+
+      if(game)
+        game->reset(config.seed);
+      else
+      {
+        game = createGame(&terminal, &roundStats, spectator, config);
+        game->setTurnListener(turnListener);
+      }
+
+      nextRoundIsReady = true;
+    }
 
     IScene* createPlayingScene() override
     {
-      return withFactory(new PlayingScene(&terminal, &match));
+      if(!nextRoundIsReady)
+        prepareNextRound();
+
+      match.round++;
+
+      nextRoundIsReady = false;
+      return withFactory(new PlayingScene(&match, game.get(), bot, botCount));
     }
 
     IScene* createScoresScene(std::vector<int> scores)
     {
-      return withFactory(new ScoreScene(&terminal, scores));
+      auto scene = withFactory(new ScoreScene(&terminal, scores));
+
+      if(analytics)
+        analytics->writeRound(*game, roundStats);
+
+      prepareNextRound();
+      return scene;
     }
 
     IScene* withFactory(IScene* s)
@@ -184,47 +520,217 @@ int main()
   };
 
   App app;
+  app.config = config;
+
+  if(spectator)
+    app.spectator = spectator.get();
+
+  app.turnListener = archive.get();
+  app.analytics = analytics.get();
+  app.bot = bot.get();
+  app.match.audio = audio.get();
+  app.botCount = botCount;
 
   std::unique_ptr<IScene> scene(app.createPlayingScene());
 
   int64_t prev = SDL_GetTicks();
   int64_t timeAccumulator = 0;
+  int64_t tickCount = 0; // the game clock
 
-  bool keepGoing = true;
+  int frameCount = 0;
+  uint64_t renderTime = 0;
 
-  while(keepGoing)
-  {
-    auto now = SDL_GetTicks();
-    timeAccumulator += now - prev;
-    prev = now;
+  // what the metrics are averaged over: they're published twice per second
+  auto metricsStart = SDL_GetPerformanceCounter();
+  int metricsTicks = 0;
+  int metricsFrames = 0;
+  uint64_t metricsTurns = 0;
+  uint64_t metricsRefreshTime = 0;
+  auto metricsAudio = audio->getStats();
 
-    while(timeAccumulator > 0)
-    {
-      timeAccumulator -= TIMESTEP_MS;
-      auto input = processInput();
+  bool keepGoing = true;
+  bool turboWasPressed = false;
+  bool frameIsDirty = true; // something may have changed on screen
+  int64_t lastDrawTime = SDL_GetTicks();
 
+  auto publishMetrics = [&] ()
+    {
+      auto now = SDL_GetPerformanceCounter();
+
+      if(!metrics || now - metricsStart < SDL_GetPerformanceFrequency() / 2)
+        return;
+
+      auto frequency = (double)SDL_GetPerformanceFrequency();
+      auto seconds = (now - metricsStart) / frequency;
+      auto audioStats = audio->getStats();
+      auto callbackCount = audioStats.callbackCount - metricsAudio.callbackCount;
+
+      LiveMetrics m {};
+      m.ticksPerSecond = metricsTicks / seconds;
+      m.turnsPerSecond = (app.match.turnCount - metricsTurns) / seconds;
+      m.frameMs = metricsFrames ? seconds * 1000.0 / metricsFrames : 0;
+      m.refreshMs = metricsFrames ? metricsRefreshTime * 1000.0 / frequency / metricsFrames : 0;
+      m.audioCallbackUs = callbackCount ? (audioStats.callbackTime - metricsAudio.callbackTime) * 1000000.0 / callbackCount : 0;
+      m.audioBufferFrames = audioStats.bufferFrames;
+      m.audioUnderruns = audioStats.underrunCount;
+      m.lateSounds = audioStats.lateSoundCount;
+      m.round = app.match.round;
+      m.joystickCount = getJoystickCount();
+      snprintf(m.scene, sizeof m.scene, "%s", scene->name());
+      metrics->publish(m);
+
+      metricsStart = now;
+      metricsTicks = 0;
+      metricsFrames = 0;
+      metricsTurns = app.match.turnCount;
+      metricsRefreshTime = 0;
+      metricsAudio = audioStats;
+    };
+
+  auto tick = [&] (GameInput input)
+    {
       if(input.quit)
       {
         keepGoing = false;
-        break;
+        return;
+      }
+
+      if(input.record && !recordWasPressed)
+      {
+        recording = !recording;
+        startStopRecording();
       }
 
+      recordWasPressed = input.record;
+
+      if(input.turbo && !turboWasPressed)
+      {
+        turbo = !turbo;
+        printf("Turbo: %s\n", turbo ? "on" : "off");
+      }
+
+      turboWasPressed = input.turbo;
+      metricsTicks++;
+      app.match.time = tickCount++ * TIMESTEP_MS / 1000.0;
+
+      if(scene->idleTicks() == 0)
+        frameIsDirty = true;
+
       auto newScene = scene->update(input);
 
       if(newScene)
       {
+        frameIsDirty = true;
         scene.reset(newScene);
         printf("New scene\n");
-	audio->beep();
+	audio->play(Sound::Beep, app.match.time);
       }
+    };
+
+  while(keepGoing)
+  {
+    if(headless)
+    {
+      timeAccumulator += HEADLESS_FRAME_MS;
     }
+    else if(turbo)
+    {
+      // as many ticks as possible until the next frame is due.
+      // Polling the input is expensive: only do it once per batch.
+      auto frameStart = SDL_GetTicks();
+
+      while(keepGoing && turbo && SDL_GetTicks() - frameStart < TURBO_FRAME_MS)
+      {
+        auto input = processInput();
+
+        for(int i = 0; i < 64 && keepGoing; ++i)
+          tick(input);
+      }
+
+      prev = SDL_GetTicks();
+      timeAccumulator = 0;
+    }
+    else
+    {
+      // nothing new to show: sleep until the next tick, or for a static
+      // scene, until it changes, an event comes, or the screen is due for
+      // a refresh
+      int idleTicks = scene->idleTicks();
+
+      if(!frameIsDirty)
+      {
+        int64_t timeout = TIMESTEP_MS;
+
+        if(idleTicks > 0)
+          timeout = min<int64_t>(idleTicks * TIMESTEP_MS, lastDrawTime + IDLE_REFRESH_MS - SDL_GetTicks());
+
+        if(timeout > 0)
+          SDL_WaitEventTimeout(nullptr, timeout);
+      }
+
+      auto now = SDL_GetTicks();
+      timeAccumulator += now - prev;
+      prev = now;
+
+      // the updates that would change nothing are passed at once: the
+      // last tick still goes through update(), with the input
+      int skipped = min<int64_t>(idleTicks, timeAccumulator / TIMESTEP_MS - 1);
+
+      if(skipped > 0)
+      {
+        scene->skip(skipped);
+        timeAccumulator -= skipped * TIMESTEP_MS;
+        tickCount += skipped;
+        metricsTicks += skipped;
+      }
+    }
+
+    while(keepGoing && timeAccumulator > 0)
+    {
+      timeAccumulator -= TIMESTEP_MS;
+      tick(processInput());
+    }
+
+    if(!headless && !turbo && !frameIsDirty && SDL_GetTicks() - lastDrawTime < IDLE_REFRESH_MS)
+    {
+      publishMetrics();
+      continue;
+    }
+
+    frameIsDirty = false;
+    lastDrawTime = SDL_GetTicks();
+
+    auto renderStart = SDL_GetPerformanceCounter();
+
+    auto& quads = app.terminal.quads;
+    quads.clear();
 
     scene->draw((int*)app.terminal.pixels);
 
     // drawScreen
-    display->refresh(app.terminal.pixels);
+    auto refreshStart = SDL_GetPerformanceCounter();
+    display->refresh(app.terminal.pixels, quads.data(), quads.size());
+
+    auto renderEnd = SDL_GetPerformanceCounter();
+    renderTime += renderEnd - renderStart;
+    metricsRefreshTime += renderEnd - refreshStart;
+    metricsFrames++;
+
+    publishMetrics();
+
+    if(frameCount == 0)
+      printf("[main] first frame after %.1f ms\n", (SDL_GetPerformanceCounter() - startTime) * 1000.0 / SDL_GetPerformanceFrequency());
+
+    if(++frameCount == maxFrames)
+      keepGoing = false;
   }
 
+  if(frameCount > 0)
+    printf("[render] %d frames, %.1f us/frame\n", frameCount, renderTime * 1000000.0 / SDL_GetPerformanceFrequency() / frameCount);
+
+  metrics.reset();
+  display.reset();
+  audio.reset();
   destroyInput();
 
   SDL_Quit();
@@ -0,0 +1,185 @@
+#include "metrics.h"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <cerrno>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace
+{
+const char MAGIC[4] = { 'L', 'R', 'L', 'M' };
+const int VERSION = 2;
+
+// The segment. The payload is guarded by a sequence lock: the writer makes
+// 'sequence' odd while it updates the payload, then even again. A reader
+// copies the payload, and keeps it if 'sequence' was the same even value
+// before and after.
+struct Segment
+{
+  char magic[4];
+  uint32_t version;
+  uint32_t size; // of the payload, for the readers to check the layout
+  int32_t pid;
+  atomic<uint32_t> sequence;
+  uint32_t reserved;
+
+  // payload
+  uint64_t updateCount;
+  int64_t publishedAt;
+  LiveMetrics metrics;
+};
+
+static_assert(atomic<uint32_t>::is_always_lock_free, "the sequence is shared between processes");
+
+auto const PAYLOAD_OFFSET = offsetof(Segment, updateCount);
+auto const PAYLOAD_SIZE = sizeof(Segment) - PAYLOAD_OFFSET;
+
+int64_t nowMs()
+{
+  using namespace chrono;
+  return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+}
+
+struct MetricsPublisher : IMetricsPublisher
+{
+  MetricsPublisher(const char* name_) : name(name_)
+  {
+    int fd = shm_open(name_, O_CREAT | O_RDWR, 0644);
+
+    if(fd < 0)
+      throw runtime_error(string("Can't create the metrics segment '") + name_ + "'");
+
+    if(ftruncate(fd, sizeof(Segment)))
+    {
+      close(fd);
+      throw runtime_error(string("Can't size the metrics segment '") + name_ + "'");
+    }
+
+    auto p = mmap(nullptr, sizeof(Segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if(p == MAP_FAILED)
+      throw runtime_error(string("Can't map the metrics segment '") + name_ + "'");
+
+    segment = (Segment*)p;
+
+    // a segment left behind by a dead process is taken over, not a live one
+    if(!memcmp(segment->magic, MAGIC, sizeof MAGIC) && segment->pid != getpid() && segment->pid > 0 && isAlive(segment->pid))
+    {
+      auto pid = segment->pid;
+      munmap(p, sizeof(Segment));
+      throw runtime_error(string("The metrics segment '") + name_ + "' is in use by process " + to_string(pid));
+    }
+
+    // readers check the header last: it's written once the rest is zeroed
+    memset(p, 0, sizeof(Segment));
+    segment->version = VERSION;
+    segment->size = PAYLOAD_SIZE;
+    segment->pid = getpid();
+    atomic_thread_fence(memory_order_release);
+    memcpy(segment->magic, MAGIC, sizeof MAGIC);
+
+    printf("[metrics] publishing to '%s'\n", name_);
+  }
+
+  ~MetricsPublisher()
+  {
+    // someone may have taken it over since, e.g once we looked dead
+    bool ours = segment->pid == getpid();
+    munmap(segment, sizeof(Segment));
+
+    if(ours)
+      shm_unlink(name.c_str());
+  }
+
+  void publish(LiveMetrics const& metrics) override
+  {
+    auto seq = segment->sequence.load(memory_order_relaxed);
+    segment->sequence.store(seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    segment->updateCount++;
+    segment->publishedAt = nowMs();
+    segment->metrics = metrics;
+
+    segment->sequence.store(seq + 2, memory_order_release);
+  }
+
+  const string name;
+  Segment* segment;
+};
+}
+
+bool isAlive(int pid)
+{
+  // EPERM: it runs, as another user
+  return kill(pid, 0) == 0 || errno == EPERM;
+}
+
+unique_ptr<IMetricsPublisher> createMetricsPublisher(const char* name)
+{
+  return make_unique<MetricsPublisher>(name);
+}
+
+bool readMetrics(const char* name, MetricsSnapshot& snapshot)
+{
+  int fd = shm_open(name, O_RDONLY, 0);
+
+  if(fd < 0)
+    return false;
+
+  // e.g a publisher that hasn't sized it yet: reading it would fault
+  struct stat st;
+
+  if(fstat(fd, &st) || st.st_size < (off_t)sizeof(Segment))
+  {
+    close(fd);
+    return false;
+  }
+
+  auto p = mmap(nullptr, sizeof(Segment), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if(p == MAP_FAILED)
+    return false;
+
+  auto segment = (Segment const*)p;
+  bool ok = false;
+
+  if(!memcmp(segment->magic, MAGIC, sizeof MAGIC) && segment->version == VERSION && segment->size == PAYLOAD_SIZE)
+  {
+    atomic_thread_fence(memory_order_acquire);
+
+    // the writer updates a few times per second: a torn read is rare
+    for(int attempt = 0; attempt < 1000 && !ok; ++attempt)
+    {
+      auto before = segment->sequence.load(memory_order_acquire);
+
+      if(before & 1)
+        continue;
+
+      snapshot.updateCount = segment->updateCount;
+      snapshot.publishedAt = segment->publishedAt;
+      snapshot.metrics = segment->metrics;
+      atomic_thread_fence(memory_order_acquire);
+
+      ok = segment->sequence.load(memory_order_relaxed) == before;
+    }
+
+    snapshot.pid = segment->pid;
+  }
+
+  munmap(p, sizeof(Segment));
+  return ok;
+}
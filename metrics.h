@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+// Live health counters of a running game, published in a POSIX shared
+// memory segment, so that monitoring tools can poll them (see monitor.cpp).
+// Rates and times are averaged over the last publishing interval.
+struct LiveMetrics
+{
+  float ticksPerSecond;
+  float turnsPerSecond;
+  float frameMs; // from a frame to the next
+  float refreshMs; // in Display::refresh
+  float audioCallbackUs; // in the mixing callback
+  int32_t audioBufferFrames; // 0: no audio
+  int32_t audioUnderruns; // since the device was opened
+  int32_t lateSounds; // idem
+  int32_t round; // 1 for the first one
+  int32_t joystickCount;
+  char scene[16];
+};
+
+struct IMetricsPublisher
+{
+  virtual ~IMetricsPublisher() = default;
+
+  // Never waits for the readers: they retry if they catch an update
+  // halfway.
+  virtual void publish(LiveMetrics const& metrics) = 0;
+};
+
+// Creates the segment 'name' (e.g "/literace"), or takes it over if its
+// publisher is gone, and removes it on destruction, unless it was taken
+// over since. Throws if another running process publishes to it.
+std::unique_ptr<IMetricsPublisher> createMetricsPublisher(const char* name);
+
+struct MetricsSnapshot
+{
+  LiveMetrics metrics;
+  int32_t pid; // of the publisher
+  uint64_t updateCount;
+  int64_t publishedAt; // in ms since the epoch
+};
+
+// Returns true if the process 'pid' is running (e.g a publisher).
+bool isAlive(int pid);
+
+// Reads a consistent snapshot of the segment 'name'. Returns false if
+// there's no such segment, or it has another layout.
+bool readMetrics(const char* name, MetricsSnapshot& snapshot);
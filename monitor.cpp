@@ -0,0 +1,86 @@
+// Monitoring tool: prints the live metrics of a running game.
+// Usage: monitor.exe [name]            one reading (default: /literace)
+//        monitor.exe [name] --watch    one line per second
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+#include "metrics.h"
+
+namespace
+{
+void printSnapshot(MetricsSnapshot const& s, int64_t age)
+{
+  auto& m = s.metrics;
+  printf("pid %d%s, update #%llu, %.1f s ago\n", s.pid, isAlive(s.pid) ? "" : " (not running)",
+         (unsigned long long)s.updateCount, age / 1000.0);
+  printf("scene: %.*s, round %d, %d joysticks\n", (int)sizeof m.scene, m.scene, m.round, m.joystickCount);
+  printf("ticks/s: %.1f, turns/s: %.1f\n", m.ticksPerSecond, m.turnsPerSecond);
+  printf("frame: %.2f ms, refresh: %.2f ms, audio callback: %.1f us\n", m.frameMs, m.refreshMs, m.audioCallbackUs);
+  printf("audio: %d samples per callback, %d underruns, %d late sounds\n", m.audioBufferFrames, m.audioUnderruns, m.lateSounds);
+}
+
+void printLine(MetricsSnapshot const& s)
+{
+  auto& m = s.metrics;
+  printf("%-8.*s round %4d  joy %d  ticks/s %7.1f  turns/s %7.1f  frame %6.2f ms  refresh %6.2f ms  audio %6.1f us  underruns %d\n",
+         (int)sizeof m.scene, m.scene, m.round, m.joystickCount, m.ticksPerSecond, m.turnsPerSecond, m.frameMs, m.refreshMs, m.audioCallbackUs,
+         m.audioUnderruns);
+}
+
+int64_t nowMs()
+{
+  timespec t;
+  clock_gettime(CLOCK_REALTIME, &t);
+  return t.tv_sec * 1000LL + t.tv_nsec / 1000000;
+}
+}
+
+int main(int argc, char* argv[])
+{
+  const char* name = "/literace";
+  bool watch = false;
+
+  for(int i = 1; i < argc; ++i)
+  {
+    if(!strcmp(argv[i], "--watch"))
+      watch = true;
+    else if(argv[i][0] != '-')
+      name = argv[i];
+    else
+    {
+      fprintf(stderr, "Usage: %s [name] [--watch]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  MetricsSnapshot snapshot {};
+
+  if(!watch)
+  {
+    if(!readMetrics(name, snapshot))
+    {
+      fprintf(stderr, "No metrics published at '%s'\n", name);
+      return 1;
+    }
+
+    printSnapshot(snapshot, nowMs() - snapshot.publishedAt);
+    return 0;
+  }
+
+  uint64_t lastUpdate = 0;
+
+  while(true)
+  {
+    if(!readMetrics(name, snapshot))
+      printf("no metrics at '%s'\n", name);
+    else if(snapshot.updateCount == lastUpdate)
+      printf("stalled for %.1f s\n", (nowMs() - snapshot.publishedAt) / 1000.0);
+    else
+      printLine(snapshot);
+
+    lastUpdate = snapshot.updateCount;
+    fflush(stdout);
+    sleep(1);
+  }
+}
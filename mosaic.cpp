@@ -0,0 +1,388 @@
+// Mosaic viewer: runs many games at once, played by bots, and shows them
+// all in one window, as a grid of tiles. E.g for a spectator wall, or to
+// watch a batch of games.
+// Usage: mosaic.exe [--games <count>] [--arena <width>x<height>] [--rate <turns/s>] [--threads <count>]
+//                   [--headless] [--frames <count>]
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "SDL.h"
+#include "board.h"
+#include "bot.h"
+#include "display.h"
+#include "game.h"
+#include "threadpool.h"
+
+using namespace std;
+
+namespace
+{
+// The grid is made to fit this, with the arenas scaled down by a power of
+// two (a chunk of the board then maps to whole pixels).
+auto const MAX_GRID_WIDTH = 1600;
+auto const MAX_GRID_HEIGHT = 900;
+
+auto const FRAME_MS = 16;
+
+// A finished round stays on screen for this long.
+auto const PAUSE_MS = 1000;
+
+// One game, and its picture, scaled down. Only the chunks of the board
+// whose hash changed since the last picture are drawn again.
+struct Tile
+{
+  unique_ptr<IGame> game;
+  uint32_t rng;
+  int pauseMs = 0;
+  unsigned seed;
+
+  int scale; // cells per pixel, on each axis
+  int width, height;
+  vector<uint32_t> pixels;
+  vector<uint64_t> chunkHashes; // as drawn, 0: empty
+  vector<int> headChunks; // where the heads were drawn
+  bool dirty = true;
+
+  void step(int turns)
+  {
+    for(int k = 0; k < turns; ++k)
+    {
+      if(game->isRoundOver())
+        break;
+
+      GameInput input {};
+
+      auto bikes = game->getBikes();
+
+      for(int i = 0; i < MAX_PLAYERS; ++i)
+        if(bikes[i].alive)
+          input.players[i] = playRandomly(*game, i, rng);
+
+      game->oneTurn(input);
+    }
+  }
+
+  void draw()
+  {
+    auto& board = game->getBoard();
+
+    // the heads are drawn over the chunks: redraw the ones they were on
+    for(auto index : headChunks)
+      chunkHashes[index] = ~0ULL;
+
+    headChunks.clear();
+
+    for(int cy = 0; cy < board.chunksY; ++cy)
+    {
+      for(int cx = 0; cx < board.chunksX; ++cx)
+      {
+        auto chunk = board.getChunk(cx, cy);
+        auto hash = chunk ? chunk->hash : 0;
+        auto& drawn = chunkHashes[cy * board.chunksX + cx];
+
+        if(hash == drawn)
+          continue;
+
+        drawChunk(cx, cy, chunk);
+        drawn = hash;
+        dirty = true;
+      }
+    }
+
+    auto bikes = game->getBikes();
+
+    for(int i = 0; i < MAX_PLAYERS; ++i)
+    {
+      if(!bikes[i].alive)
+        continue;
+
+      auto pos = bikes[i].pos;
+      drawHead(pos.x / scale, pos.y / scale, getColor(5 + i));
+      dirty = true;
+    }
+  }
+
+  // A pixel takes the color of a trail in its cells, if any: thin trails
+  // don't vanish when scaled down.
+  void drawChunk(int cx, int cy, Board::Chunk const* chunk)
+  {
+    auto& board = game->getBoard();
+    int size = Board::CHUNK_SIZE / scale;
+
+    for(int py = 0; py < size; ++py)
+    {
+      int y = cy * size + py;
+
+      if(y >= height)
+        break;
+
+      for(int px = 0; px < size; ++px)
+      {
+        int x = cx * size + px;
+
+        if(x >= width)
+          break;
+
+        int team = 0;
+
+        if(chunk)
+        {
+          for(int j = 0; j < scale && !team; ++j)
+            for(int k = 0; k < scale && !team; ++k)
+              team = chunk->cells[(py * scale + j) * Board::CHUNK_SIZE + px * scale + k];
+        }
+
+        // cells past the edge of the arena
+        if(x * scale >= board.width || y * scale >= board.height)
+          team = 0;
+
+        pixels[y * width + x] = getColor(team);
+      }
+    }
+  }
+
+  // 2x2 pixels: they can spill over the next chunks, which then get
+  // redrawn too.
+  void drawHead(int x, int y, int color)
+  {
+    auto& board = game->getBoard();
+    int size = Board::CHUNK_SIZE / scale;
+
+    for(int j = 0; j < 2; ++j)
+    {
+      for(int k = 0; k < 2; ++k)
+      {
+        int px = min(x + k, width - 1);
+        int py = min(y + j, height - 1);
+        pixels[py * width + px] = color;
+
+        int index = (py / size) * board.chunksX + px / size;
+
+        if(find(headChunks.begin(), headChunks.end(), index) == headChunks.end())
+          headChunks.push_back(index);
+      }
+    }
+  }
+};
+
+struct Options
+{
+  int gameCount = 36;
+  GameConfig config;
+  int threadCount = 0;
+  bool headless = false;
+  int maxFrames = 0;
+};
+
+int run(Options const& options)
+{
+  auto& config = options.config;
+  int count = options.gameCount;
+
+  // the smallest power of two scale that fits the whole grid
+  int columns = max(1, (int)ceil(sqrt(count * (double)config.height / config.width * MAX_GRID_WIDTH / MAX_GRID_HEIGHT)));
+  int rows = (count + columns - 1) / columns;
+  int scale = 1;
+
+  while(scale < Board::CHUNK_SIZE &&
+        (columns * ((config.width + scale - 1) / scale) > MAX_GRID_WIDTH ||
+         rows * ((config.height + scale - 1) / scale) > MAX_GRID_HEIGHT))
+    scale *= 2;
+
+  int tileWidth = (config.width + scale - 1) / scale;
+  int tileHeight = (config.height + scale - 1) / scale;
+
+  vector<Tile> tiles(count);
+
+  for(int i = 0; i < count; ++i)
+  {
+    auto& tile = tiles[i];
+    auto gameConfig = config;
+    gameConfig.seed = tile.seed = i + 1;
+    gameConfig.threadCount = 1; // the games run in parallel instead
+    tile.game = createGame(&nullTerminal, &nullSink, &nullSpectator, gameConfig);
+    tile.rng = i * 2654435761u + 1;
+
+    if(!tile.rng)
+      tile.rng = 1;
+    tile.scale = scale;
+    tile.width = tileWidth;
+    tile.height = tileHeight;
+    tile.pixels.resize(tileWidth * tileHeight, getColor(0));
+
+    auto& board = tile.game->getBoard();
+    tile.chunkHashes.assign(board.chunksX * board.chunksY, ~0ULL);
+  }
+
+  SDL_Init(options.headless ? 0 : SDL_INIT_VIDEO);
+  auto display = createMosaicDisplay(tileWidth, tileHeight, columns, rows, options.headless);
+  ThreadPool pool(options.threadCount);
+
+  printf("[mosaic] %d games of %dx%d, 1/%d scale, %d threads\n", count, config.width, config.height, scale, pool.size());
+
+  int64_t prev = SDL_GetTicks();
+  int64_t turnAccumulator = 0; // in turns * 1000
+  int frameCount = 0;
+  int64_t uploadCount = 0;
+  uint64_t stepTime = 0, refreshTime = 0;
+
+  while(true)
+  {
+    SDL_Event event;
+    bool quit = false;
+
+    while(SDL_PollEvent(&event))
+      quit |= event.type == SDL_QUIT || (event.type == SDL_KEYDOWN && event.key.keysym.scancode == SDL_SCANCODE_ESCAPE);
+
+    if(quit)
+      break;
+
+    int64_t elapsed = FRAME_MS;
+
+    if(!options.headless)
+    {
+      auto now = SDL_GetTicks();
+      elapsed = min<int64_t>(now - prev, 100); // don't try to catch up after a stall
+      prev = now;
+    }
+
+    turnAccumulator += elapsed * config.turnsPerSecond;
+    int turns = turnAccumulator / 1000;
+    turnAccumulator -= turns * 1000;
+
+    auto stepStart = SDL_GetPerformanceCounter();
+
+    auto job = [&] (int i)
+      {
+        auto& tile = tiles[i];
+
+        if(tile.game->isRoundOver())
+        {
+          tile.pauseMs += elapsed;
+
+          if(tile.pauseMs >= PAUSE_MS)
+          {
+            tile.game->reset(tile.seed += count);
+            tile.pauseMs = 0;
+          }
+        }
+
+        tile.step(turns);
+        tile.draw();
+      };
+
+    pool.parallelFor(count, job);
+
+    auto refreshStart = SDL_GetPerformanceCounter();
+
+    for(int i = 0; i < count; ++i)
+    {
+      if(!tiles[i].dirty)
+        continue;
+
+      display->updateTile(i, tiles[i].pixels.data());
+      tiles[i].dirty = false;
+      uploadCount++;
+    }
+
+    display->refresh();
+
+    auto end = SDL_GetPerformanceCounter();
+    stepTime += refreshStart - stepStart;
+    refreshTime += end - refreshStart;
+
+    if(++frameCount == options.maxFrames)
+      break;
+
+    if(!options.headless)
+    {
+      auto frameEnd = prev + FRAME_MS;
+      auto now = SDL_GetTicks();
+
+      if(frameEnd > now)
+        SDL_Delay(frameEnd - now);
+    }
+  }
+
+  auto ms = [&] (uint64_t t) { return t * 1000.0 / SDL_GetPerformanceFrequency() / max(frameCount, 1); };
+  printf("[mosaic] %d frames: games %.2f ms, uploads and draw %.2f ms, %.1f tiles uploaded per frame\n",
+         frameCount, ms(stepTime), ms(refreshTime), uploadCount / (double)max(frameCount, 1));
+
+  display.reset();
+  SDL_Quit();
+  return 0;
+}
+}
+
+int main(int argc, char* argv[])
+{
+  Options options;
+
+  for(int i = 1; i < argc; ++i)
+  {
+    string arg = argv[i];
+
+    if(arg == "--games" && i + 1 < argc)
+    {
+      options.gameCount = atoi(argv[++i]);
+
+      if(options.gameCount < 1)
+      {
+        fprintf(stderr, "Invalid game count: '%s'\n", argv[i]);
+        return 1;
+      }
+    }
+    else if(arg == "--arena" && i + 1 < argc)
+    {
+      auto& config = options.config;
+
+      if(sscanf(argv[++i], "%dx%d", &config.width, &config.height) != 2 || config.width < 1 || config.height < 1)
+      {
+        fprintf(stderr, "Invalid arena size: '%s'\n", argv[i]);
+        return 1;
+      }
+    }
+    else if(arg == "--rate" && i + 1 < argc)
+    {
+      options.config.turnsPerSecond = atoi(argv[++i]);
+
+      if(options.config.turnsPerSecond < 1)
+      {
+        fprintf(stderr, "Invalid turn rate: '%s'\n", argv[i]);
+        return 1;
+      }
+    }
+    else if(arg == "--threads" && i + 1 < argc)
+    {
+      options.threadCount = max(0, atoi(argv[++i]));
+    }
+    else if(arg == "--headless")
+    {
+      options.headless = true;
+    }
+    else if(arg == "--frames" && i + 1 < argc)
+    {
+      options.maxFrames = atoi(argv[++i]);
+    }
+    else
+    {
+      fprintf(stderr, "Usage: %s [--games <count>] [--arena <width>x<height>] [--rate <turns/s>] [--threads <count>]\n", argv[0]);
+      fprintf(stderr, "          [--headless] [--frames <count>]\n");
+      return 1;
+    }
+  }
+
+  try
+  {
+    return run(options);
+  }
+  catch(exception const& e)
+  {
+    fprintf(stderr, "Fatal: %s\n", e.what());
+    return 1;
+  }
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+// UDP protocol between the dedicated server and its players (little-endian).
+//
+// player -> server:
+//   join:    'J'                      to any port of the server
+//   input:   'I' keys:u8              to the port that sent the welcome
+//            keys: left=1 right=2 up=4 down=8 boost=16
+//   leave:   'L'
+//
+// server -> player:
+//   welcome: 'W' match:u32 bike:u8 width:u16 height:u16
+//   full:    'F'                      no free seat
+//   state:   'S' match:u32 frameCount:u32
+//            bikes: MAX_PLAYERS * { alive:u8 x:u16 y:u16 direction:u8 }
+//            obstacleCount:u16, obstacleCount * { x:u16 y:u16 w:u16 h:u16 }
+//            cellCount:u16, cellCount * { x:u16 y:u16 team:u8 }
+//
+// A player is known by its address. A state is sent after each turn of its
+// match: the cells are the ones claimed during that turn, and the obstacles
+// erase the trails under them, each turn. frameCount restarts from 1 on
+// each new round, on an empty arena. States aren't resent: a player who
+// misses one only misses its cells. A player who sends nothing for a while
+// loses its seat.
+
+#include <cstdint>
+#include <vector>
+#include "game.h" // PlayerInput
+
+static auto const NET_DEFAULT_PORT = 4242;
+static auto const NET_MAX_PACKET = 65507;
+static auto const NET_MAX_ARENA_SIZE = 0xffff; // the coordinates are u16
+
+enum NetPacket
+{
+  NET_JOIN = 'J',
+  NET_INPUT = 'I',
+  NET_LEAVE = 'L',
+  NET_WELCOME = 'W',
+  NET_FULL = 'F',
+  NET_STATE = 'S',
+};
+
+struct NetWriter
+{
+  std::vector<uint8_t> data;
+
+  void u8(int val) { data.push_back(val); }
+  void u16(int val) { u8(val & 0xff); u8((val >> 8) & 0xff); }
+  void u32(uint32_t val) { u16(val & 0xffff); u16(val >> 16); }
+};
+
+// Reads past the end return zeroes, and clear 'ok'.
+struct NetReader
+{
+  NetReader(const uint8_t* data_, int size_) : data(data_), size(size_)
+  {
+  }
+
+  int u8()
+  {
+    if(pos >= size)
+    {
+      ok = false;
+      return 0;
+    }
+
+    return data[pos++];
+  }
+
+  int u16() { int lo = u8(); return lo | u8() << 8; }
+  uint32_t u32() { uint32_t lo = u16(); return lo | (uint32_t)u16() << 16; }
+
+  const uint8_t* const data;
+  const int size;
+  int pos = 0;
+  bool ok = true;
+};
+
+inline int encodeKeys(PlayerInput input)
+{
+  return input.left << 0 | input.right << 1 | input.up << 2 | input.down << 3 | input.boost << 4;
+}
+
+inline PlayerInput decodeKeys(int keys)
+{
+  PlayerInput input {};
+  input.left = keys & 1;
+  input.right = keys & 2;
+  input.up = keys & 4;
+  input.down = keys & 8;
+  input.boost = keys & 16;
+  return input;
+}
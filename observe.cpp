@@ -0,0 +1,196 @@
+#include "observe.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+// Copies 'count' cells of row 'y' starting at 'x', wrapping around the edge.
+void readWrappedRow(Board const& board, int x, int y, int count, char* out)
+{
+  x = (x % board.width + board.width) % board.width;
+
+  while(count > 0)
+  {
+    int n = min(count, board.width - x);
+    board.readRow(x, y, n, out);
+    out += n;
+    count -= n;
+    x = 0;
+  }
+}
+
+// out[i] = in[i] ? 255 : 0
+void toOccupancy(const char* in, uint8_t* out, int count)
+{
+  int i = 0;
+
+#ifdef __SSE2__
+  auto const zero = _mm_setzero_si128();
+  auto const ones = _mm_set1_epi8(-1);
+
+  for(; i + 16 <= count; i += 16)
+  {
+    auto cells = _mm_loadu_si128((const __m128i*)(in + i));
+    auto empty = _mm_cmpeq_epi8(cells, zero);
+    _mm_storeu_si128((__m128i*)(out + i), _mm_xor_si128(empty, ones));
+  }
+#endif
+
+  for(; i < count; ++i)
+    out[i] = in[i] ? 255 : 0;
+}
+
+// Averages 2x2 blocks of two rows. 'row0' and 'row1' have '2 * count' cells.
+void downsampleRows(const uint8_t* row0, const uint8_t* row1, uint8_t* out, int count)
+{
+  int i = 0;
+
+#ifdef __SSE2__
+  auto const lowBytes = _mm_set1_epi16(0x00ff);
+
+  for(; i + 16 <= count; i += 16)
+  {
+    auto a = _mm_loadu_si128((const __m128i*)(row0 + 2 * i));
+    auto b = _mm_loadu_si128((const __m128i*)(row0 + 2 * i + 16));
+    auto c = _mm_loadu_si128((const __m128i*)(row1 + 2 * i));
+    auto d = _mm_loadu_si128((const __m128i*)(row1 + 2 * i + 16));
+
+    // vertical average, then horizontal average of even/odd bytes
+    auto v0 = _mm_avg_epu8(a, c);
+    auto v1 = _mm_avg_epu8(b, d);
+    auto h0 = _mm_avg_epu16(_mm_and_si128(v0, lowBytes), _mm_srli_epi16(v0, 8));
+    auto h1 = _mm_avg_epu16(_mm_and_si128(v1, lowBytes), _mm_srli_epi16(v1, 8));
+    _mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(h0, h1));
+  }
+#endif
+
+  for(; i < count; ++i)
+  {
+    int left = (row0[2 * i] + row1[2 * i] + 1) / 2;
+    int right = (row0[2 * i + 1] + row1[2 * i + 1] + 1) / 2;
+    out[i] = (left + right + 1) / 2;
+  }
+}
+
+void downsample(const uint8_t* in, int width, int height, uint8_t* out, int outWidth, int outHeight)
+{
+  // odd sizes: pad each row with its first cell (the board wraps)
+  thread_local vector<uint8_t> row0, row1;
+  row0.resize(outWidth * 2);
+  row1.resize(outWidth * 2);
+
+  for(int y = 0; y < outHeight; ++y)
+  {
+    auto src0 = in + (2 * y) * width;
+    auto src1 = in + ((2 * y + 1) % height) * width;
+
+    if(width % 2 == 0)
+    {
+      downsampleRows(src0, src1, out + y * outWidth, outWidth);
+      continue;
+    }
+
+    memcpy(row0.data(), src0, width);
+    memcpy(row1.data(), src1, width);
+    row0[width] = src0[0];
+    row1[width] = src1[0];
+    downsampleRows(row0.data(), row1.data(), out + y * outWidth, outWidth);
+  }
+}
+}
+
+void extractView(Board const& board, Vec2 center, Direction direction, int size, uint8_t* out)
+{
+  thread_local vector<char> crop;
+  crop.resize(size * size);
+
+  int top = center.y - size / 2;
+  int left = center.x - size / 2;
+
+  for(int row = 0; row < size; ++row)
+  {
+    int y = ((top + row) % board.height + board.height) % board.height;
+    readWrappedRow(board, left, y, size, &crop[row * size]);
+  }
+
+  auto at = [&] (int row, int col) { return (uint8_t)crop[row * size + col]; };
+  int last = size - 1;
+
+  switch(direction)
+  {
+  case Direction::Down:
+    for(int r = 0; r < size; ++r)
+      for(int c = 0; c < size; ++c)
+        out[r * size + c] = at(last - r, last - c);
+
+    break;
+  case Direction::Right:
+    for(int r = 0; r < size; ++r)
+      for(int c = 0; c < size; ++c)
+        out[r * size + c] = at(c, last - r);
+
+    break;
+  case Direction::Left:
+    for(int r = 0; r < size; ++r)
+      for(int c = 0; c < size; ++c)
+        out[r * size + c] = at(last - c, r);
+
+    break;
+  default:
+    memcpy(out, crop.data(), size * size);
+    break;
+  }
+}
+
+int pyramidSize(int width, int height, int levels)
+{
+  int total = 0;
+
+  for(int i = 0; i < levels; ++i)
+  {
+    total += width * height;
+    width = (width + 1) / 2;
+    height = (height + 1) / 2;
+  }
+
+  return total;
+}
+
+void extractPyramid(Board const& board, int levels, uint8_t* out)
+{
+  if(levels <= 0)
+    return;
+
+  thread_local vector<char> row;
+  row.resize(board.width);
+
+  for(int y = 0; y < board.height; ++y)
+  {
+    board.readRow(0, y, board.width, row.data());
+    toOccupancy(row.data(), out + y * board.width, board.width);
+  }
+
+  int width = board.width;
+  int height = board.height;
+
+  for(int i = 1; i < levels; ++i)
+  {
+    int outWidth = (width + 1) / 2;
+    int outHeight = (height + 1) / 2;
+    auto next = out + width * height;
+
+    downsample(out, width, height, next, outWidth, outHeight);
+
+    out = next;
+    width = outWidth;
+    height = outHeight;
+  }
+}
+
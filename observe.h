@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+#include "board.h"
+#include "game.h" // Vec2, Direction
+
+// Observation kernels, for agents and analytics.
+// They read the (toroidal) board directly, and write into preallocated
+// buffers: no allocation once warmed up.
+
+// size x size crop of the board around 'center', rotated so that
+// 'direction' points up. Cells hold the team (1-4), or 0 when empty.
+// The center is at row size/2, column size/2 of the unrotated crop.
+void extractView(Board const& board, Vec2 center, Direction direction, int size, uint8_t* out);
+
+// Occupancy pyramid of the whole board: level 0 has one byte per cell
+// (0: empty, 255: taken), each next level halves both dimensions (rounding
+// up, and wrapping around the edges), and holds the average of 2x2 cells.
+// The levels are stored one after the other.
+int pyramidSize(int width, int height, int levels);
+void extractPyramid(Board const& board, int levels, uint8_t* out);
+
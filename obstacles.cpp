@@ -0,0 +1,184 @@
+#include "obstacles.h"
+#include <algorithm>
+#include <cstdlib>
+
+using namespace std;
+
+namespace
+{
+auto const GRID_BITS = 6;
+auto const GRID_SIZE = 1 << GRID_BITS;
+
+bool pointInsideSegment(int p, int left, int width, int mod)
+{
+  p = (p + mod) % mod;
+  left = (left + mod) % mod;
+
+  while(p < left)
+    p += mod;
+
+  return p >= left && p <= left + width;
+}
+
+// Calls func(gridPos) for the grid positions covering [pos, pos + len],
+// wrapping around the edge.
+template<typename Func>
+void forEachSpan(int pos, int len, int mod, int gridSize, Func func)
+{
+  if(len < 0)
+    return;
+
+  len = min(len, mod - 1);
+
+  int end = min(pos + len, mod - 1);
+
+  for(int k = pos >> GRID_BITS; k <= end >> GRID_BITS; ++k)
+    func(k);
+
+  if(pos + len >= mod)
+  {
+    for(int k = 0; k <= (pos + len - mod) >> GRID_BITS && k < gridSize; ++k)
+      func(k);
+  }
+}
+}
+
+Obstacles::Obstacles(int width_, int height_) :
+  width(width_),
+  height(height_),
+  gridWidth((width_ + GRID_SIZE - 1) / GRID_SIZE),
+  gridHeight((height_ + GRID_SIZE - 1) / GRID_SIZE)
+{
+  gridStart.resize(gridWidth * gridHeight + 1);
+}
+
+void Obstacles::clear()
+{
+  for(auto array : { &x, &y, &vx, &vy, &w, &h })
+    array->clear();
+
+  gridIsValid = false;
+}
+
+void Obstacles::add(Obstacle ob)
+{
+  x.push_back(ob.pos.x);
+  y.push_back(ob.pos.y);
+  vx.push_back(ob.vel.x);
+  vy.push_back(ob.vel.y);
+  w.push_back(ob.size.x);
+  h.push_back(ob.size.y);
+
+  gridIsValid = false;
+}
+
+void Obstacles::copyFrom(Obstacles const& other)
+{
+  x = other.x;
+  y = other.y;
+  vx = other.vx;
+  vy = other.vy;
+  w = other.w;
+  h = other.h;
+
+  gridStart = other.gridStart;
+  gridItems = other.gridItems;
+  gridIsValid = other.gridIsValid;
+}
+
+void Obstacles::move(const int* jitter)
+{
+  int n = size();
+  auto px = x.data();
+  auto py = y.data();
+  auto pvx = vx.data();
+  auto pvy = vy.data();
+  auto pw = w.data();
+  auto ph = h.data();
+
+  for(int i = 0; i < n; ++i)
+  {
+    px[i] += jitter[i * 4 + 0] + pvx[i];
+    py[i] += jitter[i * 4 + 1] + pvy[i];
+    pw[i] += jitter[i * 4 + 2];
+    ph[i] += jitter[i * 4 + 3];
+  }
+
+  // bounce
+  for(int i = 0; i < n; ++i)
+  {
+    pvx[i] = px[i] < 0 ? abs(pvx[i]) : pvx[i];
+    pvx[i] = px[i] >= width ? -abs(pvx[i]) : pvx[i];
+    pvy[i] = py[i] < 0 ? abs(pvy[i]) : pvy[i];
+    pvy[i] = py[i] >= height ? -abs(pvy[i]) : pvy[i];
+  }
+
+  // wrap: an obstacle moves by 2 cells at most
+  for(int i = 0; i < n; ++i)
+  {
+    px[i] += px[i] < 0 ? width : 0;
+    px[i] -= px[i] >= width ? width : 0;
+    py[i] += py[i] < 0 ? height : 0;
+    py[i] -= py[i] >= height ? height : 0;
+  }
+
+  buildGrid();
+}
+
+bool Obstacles::hits(Vec2 pos)
+{
+  if(!gridIsValid)
+    buildGrid();
+
+  int cell = (pos.y >> GRID_BITS) * gridWidth + (pos.x >> GRID_BITS);
+
+  for(int k = gridStart[cell]; k < gridStart[cell + 1]; ++k)
+    if(covers(gridItems[k], pos))
+      return true;
+
+  return false;
+}
+
+bool Obstacles::covers(int i, Vec2 pos) const
+{
+  return pointInsideSegment(pos.x, x[i], w[i], width)
+         && pointInsideSegment(pos.y, y[i], h[i], height);
+}
+
+template<typename Func>
+void Obstacles::forEachGridCell(int i, Func func) const
+{
+  auto row = [&] (int gy)
+    {
+      forEachSpan(x[i], w[i], width, gridWidth, [&] (int gx) { func(gy * gridWidth + gx); });
+    };
+
+  forEachSpan(y[i], h[i], height, gridHeight, row);
+}
+
+// Counting sort of the obstacles by grid cell.
+void Obstacles::buildGrid()
+{
+  fill(gridStart.begin(), gridStart.end(), 0);
+
+  for(int i = 0; i < size(); ++i)
+    forEachGridCell(i, [&] (int cell) { gridStart[cell + 1]++; });
+
+  for(int k = 1; k < (int)gridStart.size(); ++k)
+    gridStart[k] += gridStart[k - 1];
+
+  gridItems.resize(gridStart.back());
+
+  // fill: gridStart[k] is the next free slot of cell k; once filled, it
+  // ends up at the start of cell k+1
+  for(int i = 0; i < size(); ++i)
+    forEachGridCell(i, [&] (int cell) { gridItems[gridStart[cell]++] = i; });
+
+  // which leaves gridStart shifted by one cell
+  for(int k = (int)gridStart.size() - 1; k > 0; --k)
+    gridStart[k] = gridStart[k - 1];
+
+  gridStart[0] = 0;
+  gridIsValid = true;
+}
+
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vector>
+#include "game.h" // Obstacle, Vec2
+
+// The moving obstacles, stored as a structure of arrays: moving them all is
+// a handful of loops the compiler can vectorize.
+// A uniform grid indexes them by area, so finding the obstacles that cover
+// a cell doesn't depend on the number of obstacles.
+struct Obstacles
+{
+  Obstacles(int width, int height);
+
+  void clear();
+  void add(Obstacle ob);
+
+  // Same arena size: a flat copy of the arrays, reusing their storage.
+  void copyFrom(Obstacles const& other);
+
+  int size() const
+  {
+    return (int)x.size();
+  }
+
+  Obstacle get(int i) const
+  {
+    return { { x[i], y[i] }, { vx[i], vy[i] }, { w[i], h[i] }, true };
+  }
+
+  // 'jitter' holds 4 values in [-1, 1] per obstacle: x, y, width, height.
+  void move(const int* jitter);
+
+  // Returns true if 'pos' lies inside an obstacle (edges included).
+  bool hits(Vec2 pos);
+
+  std::vector<int> x, y, vx, vy, w, h;
+
+private:
+  void buildGrid();
+  bool covers(int i, Vec2 pos) const;
+
+  template<typename Func>
+  void forEachGridCell(int i, Func func) const;
+
+  const int width, height;
+  const int gridWidth, gridHeight;
+
+  // the obstacles of grid cell 'k' are
+  // gridItems[gridStart[k]] ... gridItems[gridStart[k + 1] - 1]
+  std::vector<int> gridStart;
+  std::vector<int> gridItems;
+  bool gridIsValid = false;
+};
+
@@ -0,0 +1,148 @@
+#include "recorder.h"
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace
+{
+// Frames waiting to be written. Beyond this, new frames are dropped.
+auto const MAX_PENDING_FRAMES = 8;
+
+struct Recorder : IRecorder
+{
+  Recorder(string dir_, int width_, int height_, bool bottomUp_) : dir(dir_), width(width_), height(height_), bottomUp(bottomUp_)
+  {
+    for(size_t i = 1; i <= dir.size(); ++i)
+      if(i == dir.size() || dir[i] == '/')
+        mkdir(dir.substr(0, i).c_str(), 0755);
+
+    struct stat st;
+
+    if(stat(dir.c_str(), &st) || !S_ISDIR(st.st_mode))
+      throw runtime_error("Can't create capture directory: '" + dir + "'");
+
+    printf("[capture] recording to '%s'\n", dir.c_str());
+
+    worker = thread(&Recorder::run, this);
+  }
+
+  ~Recorder()
+  {
+    {
+      unique_lock<mutex> lock(m_mutex);
+      quit = true;
+    }
+
+    wakeUp.notify_one();
+    worker.join();
+
+    printf("[capture] %d frames written, %d dropped\n", written, dropped);
+  }
+
+  void write(const uint8_t* bgra) override
+  {
+    vector<uint8_t> frame;
+
+    {
+      unique_lock<mutex> lock(m_mutex);
+
+      if(pending.size() >= MAX_PENDING_FRAMES)
+      {
+        dropped++;
+        return;
+      }
+
+      if(!freeFrames.empty())
+      {
+        frame = move(freeFrames.back());
+        freeFrames.pop_back();
+      }
+    }
+
+    frame.assign(bgra, bgra + width * height * 4);
+
+    {
+      unique_lock<mutex> lock(m_mutex);
+      pending.push_back(move(frame));
+    }
+
+    wakeUp.notify_one();
+  }
+
+  void run()
+  {
+    vector<uint8_t> rgb(width * height * 3);
+    int index = 0;
+
+    while(true)
+    {
+      vector<uint8_t> frame;
+
+      {
+        unique_lock<mutex> lock(m_mutex);
+        wakeUp.wait(lock, [&] { return quit || !pending.empty(); });
+
+        if(pending.empty())
+          break;
+
+        frame = move(pending.front());
+        pending.pop_front();
+      }
+
+      // drop the alpha channel, and flip vertically if needed
+      for(int y = 0; y < height; ++y)
+      {
+        auto src = &frame[(bottomUp ? height - 1 - y : y) * width * 4];
+        auto dst = &rgb[y * width * 3];
+
+        for(int x = 0; x < width; ++x)
+        {
+          dst[x * 3 + 0] = src[x * 4 + 2];
+          dst[x * 3 + 1] = src[x * 4 + 1];
+          dst[x * 3 + 2] = src[x * 4 + 0];
+        }
+      }
+
+      char path[512];
+      snprintf(path, sizeof path, "%s/frame-%06d.ppm", dir.c_str(), index++);
+
+      if(auto fp = fopen(path, "wb"))
+      {
+        fprintf(fp, "P6\n%d %d\n255\n", width, height);
+        fwrite(rgb.data(), 1, rgb.size(), fp);
+        fclose(fp);
+        written++;
+      }
+
+      unique_lock<mutex> lock(m_mutex);
+      freeFrames.push_back(move(frame));
+    }
+  }
+
+  const string dir;
+  const int width, height;
+  const bool bottomUp;
+
+  thread worker;
+  mutex m_mutex;
+  condition_variable wakeUp;
+  deque<vector<uint8_t>> pending;
+  vector<vector<uint8_t>> freeFrames;
+  bool quit = false;
+  int written = 0;
+  int dropped = 0;
+};
+}
+
+unique_ptr<IRecorder> createRecorder(string dir, int width, int height, bool bottomUp)
+{
+  return make_unique<Recorder>(dir, width, height, bottomUp);
+}
+
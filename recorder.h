@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Writes frames to disk as a numbered PPM image sequence.
+// Encoding and disk I/O happen on a worker thread: 'write' never blocks.
+// If the disk can't keep up, frames are dropped (and counted).
+struct IRecorder
+{
+  virtual ~IRecorder() = default;
+
+  virtual void write(const uint8_t* bgra) = 0;
+};
+
+// 'bottomUp' is for frames read back from OpenGL.
+std::unique_ptr<IRecorder> createRecorder(std::string dir, int width, int height, bool bottomUp = true);
+
@@ -0,0 +1,129 @@
+// Replay archive tool: lists the rounds of an archive, or restores a turn.
+// Usage: replay.exe <archive>                   lists the rounds
+//        replay.exe <archive> <round> <turn>    restores a turn, prints the bikes
+//        replay.exe <archive> --verify          checks seeking against full replays
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "archive.h"
+
+using namespace std;
+
+namespace
+{
+double elapsedUs(chrono::steady_clock::time_point since)
+{
+  return chrono::duration<double, micro>(chrono::steady_clock::now() - since).count();
+}
+
+void listRounds(IReplayArchive& archive)
+{
+  for(int i = 0; i < archive.roundCount(); ++i)
+  {
+    auto config = archive.roundConfig(i);
+    printf("round %d: %dx%d, speed %d/%d, %d turns, %d keyframes\n", i, config.width, config.height, config.speed, config.boostSpeed,
+           archive.turnCount(i), archive.keyframeCount(i));
+  }
+}
+
+void showTurn(IReplayArchive& archive, int round, int turn)
+{
+  auto game = createGame(&nullTerminal, &nullSink, &nullSpectator, archive.roundConfig(round));
+
+  auto start = chrono::steady_clock::now();
+  archive.seek(*game, round, turn);
+  printf("round %d, turn %d (restored in %.0f us), state hash: %016llx\n", round, turn, elapsedUs(start), (unsigned long long)game->getStateHash());
+
+  auto bikes = game->getBikes();
+
+  for(int i = 0; i < MAX_PLAYERS; ++i)
+    printf("bike %d: %s at %d,%d, trail: %d cells\n", i + 1, bikes[i].alive ? "alive" : "dead", bikes[i].pos.x, bikes[i].pos.y, game->getTrailLength(i + 1));
+}
+
+// Plays each round from its start, and compares the states reached to
+// the ones restored by seeking.
+int verify(IReplayArchive& archive)
+{
+  auto const STRIDE = 97; // not a multiple of the keyframe interval
+  int failures = 0;
+  int seeks = 0;
+  double seekTime = 0;
+
+  for(int round = 0; round < archive.roundCount(); ++round)
+  {
+    auto config = archive.roundConfig(round);
+    auto played = createGame(&nullTerminal, &nullSink, &nullSpectator, config);
+    auto restored = createGame(&nullTerminal, &nullSink, &nullSpectator, config);
+    archive.seek(*played, round, 0);
+
+    for(int turn = 0; turn <= archive.turnCount(round); ++turn)
+    {
+      if(turn % STRIDE == 0 || turn == archive.turnCount(round))
+      {
+        auto start = chrono::steady_clock::now();
+        archive.seek(*restored, round, turn);
+        seekTime += elapsedUs(start);
+        seeks++;
+
+        vector<uint8_t> a, b;
+        played->saveState(a);
+        restored->saveState(b);
+
+        if(a != b || played->getStateHash() != restored->getStateHash())
+        {
+          printf("round %d, turn %d: mismatch\n", round, turn);
+          failures++;
+        }
+      }
+
+      if(turn < archive.turnCount(round))
+        played->oneTurn(archive.input(round, turn));
+    }
+  }
+
+  printf("%d rounds, %d seeks (%.0f us on average), %d mismatches\n",
+         archive.roundCount(), seeks, seeks ? seekTime / seeks : 0.0, failures);
+
+  return failures ? 1 : 0;
+}
+}
+
+int main(int argc, char* argv[])
+{
+  if(argc != 2 && argc != 3 && argc != 4)
+  {
+    fprintf(stderr, "Usage: %s <archive> [<round> <turn> | --verify]\n", argv[0]);
+    return 1;
+  }
+
+  try
+  {
+    auto start = chrono::steady_clock::now();
+    auto archive = openReplayArchive(argv[1]);
+    printf("[replay] %d rounds, opened in %.0f us\n", archive->roundCount(), elapsedUs(start));
+
+    if(argc == 2)
+      listRounds(*archive);
+    else if(argc == 3 && !strcmp(argv[2], "--verify"))
+      return verify(*archive);
+    else if(argc == 4)
+      showTurn(*archive, atoi(argv[2]), atoi(argv[3]));
+    else
+    {
+      fprintf(stderr, "Usage: %s <archive> [<round> <turn> | --verify]\n", argv[0]);
+      return 1;
+    }
+  }
+  catch(exception const& e)
+  {
+    fprintf(stderr, "Fatal: %s\n", e.what());
+    return 1;
+  }
+
+  return 0;
+}
+
@@ -16,5 +16,13 @@ struct IScene
   ISceneFactory* factory = nullptr;
   virtual IScene* update(GameInput input) = 0;
   virtual void draw(int* pixels) = 0;
+  virtual const char* name() = 0; // for monitoring
+
+  // How many of the next updates would change nothing on screen, and
+  // return no new scene, given the same input (e.g a countdown). The main
+  // loop sleeps through them, and passes them to skip() at once.
+  // 0: the scene is animated.
+  virtual int idleTicks() { return 0; }
+  virtual void skip(int ticks) {}
 };
 
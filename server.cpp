@@ -0,0 +1,729 @@
+// Dedicated server: hosts many matches in one process, for online arenas.
+// Usage: server.exe [--port <port>] [--matches <count>] [--shards <count>]
+//                   [--arena <width>x<height>] [--rate <turns/s>] [--speed <cells/turn>]
+//                   [--seconds <duration>]
+//
+// The matches are split between shards, one thread per core. A shard owns
+// its matches and a UDP socket (port + shard index), and runs both from an
+// epoll loop, woken up by the socket and by a turn timer: the shards share
+// nothing but the lobby, which seats the joining players.
+// See netproto.h for the protocol.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "board.h"
+#include "game.h"
+#include "netproto.h"
+
+using namespace std;
+
+namespace
+{
+// A player who sends nothing for this long loses its seat.
+auto const PLAYER_TIMEOUT_MS = 5000;
+
+// Turns a late shard plays to catch up; the others are skipped.
+auto const MAX_CATCH_UP = 4;
+
+// Datagrams per recvmmsg/sendmmsg call.
+auto const BATCH_SIZE = 64;
+
+atomic<bool> g_running { true };
+
+int64_t nowMs()
+{
+  using namespace chrono;
+  return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t addressKey(sockaddr_in const& addr)
+{
+  return (uint64_t)addr.sin_addr.s_addr << 16 | addr.sin_port;
+}
+
+struct Seat
+{
+  int match;
+  int bike;
+};
+
+// Seats the players, first come first served: a match is filled up before
+// the next one gets players. Shared by all the shards.
+struct Lobby
+{
+  Lobby(int matchCount) : seatMasks(matchCount)
+  {
+  }
+
+  // A player already seated gets the same seat. Returns false if all the
+  // seats are taken.
+  bool seat(uint64_t player, Seat& seat)
+  {
+    lock_guard<mutex> lock(m_mutex);
+
+    auto i = seats.find(player);
+
+    if(i != seats.end())
+    {
+      seat = i->second;
+      return true;
+    }
+
+    for(int m = 0; m < (int)seatMasks.size(); ++m)
+    {
+      for(int bike = 0; bike < MAX_PLAYERS; ++bike)
+      {
+        if(seatMasks[m] & (1 << bike))
+          continue;
+
+        seatMasks[m] |= 1 << bike;
+        seat = { m, bike };
+        seats[player] = seat;
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  void leave(uint64_t player)
+  {
+    lock_guard<mutex> lock(m_mutex);
+
+    auto i = seats.find(player);
+
+    if(i == seats.end())
+      return;
+
+    seatMasks[i->second.match] &= ~(1 << i->second.bike);
+    seats.erase(i);
+  }
+
+  mutex m_mutex;
+  map<uint64_t, Seat> seats; // by player address
+  vector<int> seatMasks; // per match
+};
+
+struct Player
+{
+  sockaddr_in addr;
+  int bike;
+  PlayerInput input;
+  int64_t lastHeard;
+};
+
+struct Cell
+{
+  Vec2 pos;
+  int team;
+};
+
+// A game, and what changed during its last turn.
+struct Match : ISpectator
+{
+  Match(int index_, GameConfig config) : index(index_), seed(config.seed)
+  {
+    game = createGame(&nullTerminal, &nullSink, this, config);
+  }
+
+  void onNewRound(int, int, int) override
+  {
+    cells.clear();
+  }
+
+  void onCell(Vec2 pos, int team) override
+  {
+    cells.push_back({ pos, team });
+  }
+
+  void onErase(Vec2, Vec2) override
+  {
+    // the players erase under the obstacles themselves
+  }
+
+  void onFrame(int frameCount_, Bike const*, vector<Obstacle> const& obstacles_) override
+  {
+    frameCount = frameCount_;
+    obstacles.assign(obstacles_.begin(), obstacles_.end());
+  }
+
+  void playTurn()
+  {
+    if(game->isRoundOver())
+      game->reset(++seed);
+
+    GameInput input {};
+
+    for(auto& player : players)
+      input.players[player.bike] = player.input;
+
+    cells.clear();
+    game->oneTurn(input);
+    encodeState();
+  }
+
+  void encodeState()
+  {
+    auto bikes = game->getBikes();
+
+    auto& w = packet;
+    w.data.clear();
+    w.u8(NET_STATE);
+    w.u32(index);
+    w.u32(frameCount);
+
+    for(int i = 0; i < MAX_PLAYERS; ++i)
+    {
+      w.u8(bikes[i].alive);
+      w.u16(bikes[i].pos.x);
+      w.u16(bikes[i].pos.y);
+      w.u8((int)bikes[i].direction);
+    }
+
+    // what fits in a datagram
+    int obstacleCount = min<int>(obstacles.size(), 4096);
+    int cellCount = min<int>(cells.size(), (NET_MAX_PACKET - 64 - obstacleCount * 8) / 5);
+
+    w.u16(obstacleCount);
+
+    for(int i = 0; i < obstacleCount; ++i)
+    {
+      w.u16(obstacles[i].pos.x);
+      w.u16(obstacles[i].pos.y);
+      w.u16(obstacles[i].size.x);
+      w.u16(obstacles[i].size.y);
+    }
+
+    w.u16(cellCount);
+
+    for(int i = 0; i < cellCount; ++i)
+    {
+      w.u16(cells[i].pos.x);
+      w.u16(cells[i].pos.y);
+      w.u8(cells[i].team);
+    }
+  }
+
+  const int index;
+  unsigned seed;
+  unique_ptr<IGame> game;
+  vector<Player> players;
+  int frameCount = 0;
+  vector<Cell> cells; // claimed during the last turn
+  vector<Obstacle> obstacles;
+  NetWriter packet; // the last state
+};
+
+int createSocket(int port)
+{
+  int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+
+  sockaddr_in addr {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+
+  if(fd < 0 || bind(fd, (sockaddr*)&addr, sizeof addr))
+    throw runtime_error("Can't bind UDP port " + to_string(port));
+
+  // room for the bursts of states
+  int bufferSize = 4 << 20;
+  setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof bufferSize);
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof bufferSize);
+
+  return fd;
+}
+
+struct ShardStats
+{
+  atomic<int64_t> turns { 0 }; // summed over the matches
+  atomic<int64_t> missedTicks { 0 };
+  atomic<int64_t> busyUs { 0 };
+  atomic<int64_t> packetsIn { 0 };
+  atomic<int64_t> packetsOut { 0 };
+  atomic<int64_t> bytesOut { 0 };
+  atomic<int> players { 0 };
+};
+
+struct Shard
+{
+  Shard(int port, Lobby& lobby_) : lobby(lobby_)
+  {
+    fd = createSocket(port);
+  }
+
+  ~Shard()
+  {
+    close(fd);
+  }
+
+  // Called by the shard which received the join.
+  void queueJoin(sockaddr_in addr, Seat seat)
+  {
+    lock_guard<mutex> lock(joinMutex);
+    joins.push_back({ addr, seat });
+  }
+
+  void run(vector<Shard*> const& shards, int turnsPerSecond)
+  {
+    int timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    auto turnNs = 1000000000LL / turnsPerSecond;
+    itimerspec period {};
+    period.it_interval.tv_sec = turnNs / 1000000000;
+    period.it_interval.tv_nsec = turnNs % 1000000000;
+    period.it_value = period.it_interval;
+    timerfd_settime(timer, 0, &period, nullptr);
+
+    int epfd = epoll_create1(0);
+    epoll_event ev {};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+    ev.data.fd = timer;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, timer, &ev);
+
+    while(g_running)
+    {
+      epoll_event events[2];
+      int count = epoll_wait(epfd, events, 2, 200);
+
+      for(int i = 0; i < count; ++i)
+      {
+        auto start = chrono::steady_clock::now();
+
+        if(events[i].data.fd == fd)
+          receive(shards);
+        else
+        {
+          uint64_t expirations = 0;
+
+          if(read(timer, &expirations, sizeof expirations) == sizeof expirations)
+          {
+            int turns = min<uint64_t>(expirations, MAX_CATCH_UP);
+            stats.missedTicks += expirations - turns;
+
+            for(int k = 0; k < turns; ++k)
+              tick();
+          }
+        }
+
+        stats.busyUs += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+      }
+    }
+
+    close(epfd);
+    close(timer);
+  }
+
+  void receive(vector<Shard*> const& shards)
+  {
+    uint8_t buffers[BATCH_SIZE][256];
+    sockaddr_in addrs[BATCH_SIZE];
+    iovec iovs[BATCH_SIZE];
+    mmsghdr msgs[BATCH_SIZE];
+
+    while(true)
+    {
+      for(int i = 0; i < BATCH_SIZE; ++i)
+      {
+        iovs[i] = { buffers[i], sizeof buffers[i] };
+        msgs[i] = {};
+        msgs[i].msg_hdr.msg_name = &addrs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof addrs[i];
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+      }
+
+      int count = recvmmsg(fd, msgs, BATCH_SIZE, MSG_DONTWAIT, nullptr);
+
+      if(count <= 0)
+        return;
+
+      stats.packetsIn += count;
+
+      for(int i = 0; i < count; ++i)
+        onPacket(addrs[i], NetReader(buffers[i], msgs[i].msg_len), shards);
+    }
+  }
+
+  void onPacket(sockaddr_in const& addr, NetReader r, vector<Shard*> const& shards)
+  {
+    auto key = addressKey(addr);
+
+    switch(r.u8())
+    {
+    case NET_JOIN:
+      {
+        Seat seat;
+
+        if(lobby.seat(key, seat))
+          shards[seat.match % shards.size()]->queueJoin(addr, seat);
+        else
+        {
+          NetWriter w;
+          w.u8(NET_FULL);
+          sendto(fd, w.data.data(), w.data.size(), 0, (sockaddr*)&addr, sizeof addr);
+        }
+
+        break;
+      }
+    case NET_INPUT:
+      {
+        auto keys = r.u8();
+        auto i = playerMatches.find(key);
+
+        if(!r.ok || i == playerMatches.end())
+          break; // e.g sent to another shard
+
+        for(auto& player : i->second->players)
+        {
+          if(addressKey(player.addr) == key)
+          {
+            player.input = decodeKeys(keys);
+            player.lastHeard = nowMs();
+          }
+        }
+
+        break;
+      }
+    case NET_LEAVE:
+      {
+        auto i = playerMatches.find(key);
+
+        if(i != playerMatches.end())
+          removePlayer(*i->second, key);
+
+        break;
+      }
+    }
+  }
+
+  void removePlayer(Match& match, uint64_t key)
+  {
+    auto& players = match.players;
+
+    for(int i = 0; i < (int)players.size(); ++i)
+    {
+      if(addressKey(players[i].addr) == key)
+      {
+        players.erase(players.begin() + i);
+        break;
+      }
+    }
+
+    playerMatches.erase(key);
+    lobby.leave(key);
+    stats.players--;
+  }
+
+  void seatNewPlayers()
+  {
+    {
+      lock_guard<mutex> lock(joinMutex);
+      swap(joins, seating);
+    }
+
+    for(auto& join : seating)
+    {
+      auto key = addressKey(join.addr);
+      auto& match = *matches[join.seat.match / shardCount];
+
+      // a join sent again (our welcome got lost) only gets a new welcome
+      if(!playerMatches.count(key))
+      {
+        match.players.push_back({ join.addr, join.seat.bike, {}, nowMs() });
+        playerMatches[key] = &match;
+        stats.players++;
+      }
+
+      NetWriter w;
+      w.u8(NET_WELCOME);
+      w.u32(match.index);
+      w.u8(join.seat.bike);
+      w.u16(match.game->getBoard().width);
+      w.u16(match.game->getBoard().height);
+      sendto(fd, w.data.data(), w.data.size(), 0, (sockaddr*)&join.addr, sizeof join.addr);
+    }
+
+    seating.clear();
+  }
+
+  void dropSilentPlayers()
+  {
+    auto now = nowMs();
+
+    for(auto& match : matches)
+    {
+      for(int i = (int)match->players.size() - 1; i >= 0; --i)
+      {
+        auto& player = match->players[i];
+
+        if(now - player.lastHeard > PLAYER_TIMEOUT_MS)
+          removePlayer(*match, addressKey(player.addr));
+      }
+    }
+  }
+
+  // One turn of each match that has players, then their states.
+  void tick()
+  {
+    seatNewPlayers();
+
+    if(++tickCount % 256 == 0)
+      dropSilentPlayers();
+
+    int turns = 0;
+    sends.clear();
+
+    for(auto& match : matches)
+    {
+      if(match->players.empty())
+        continue;
+
+      match->playTurn();
+      turns++;
+
+      for(auto& player : match->players)
+        sends.push_back({ match, &player.addr });
+    }
+
+    stats.turns += turns;
+    flushSends();
+  }
+
+  void flushSends()
+  {
+    iovec iovs[BATCH_SIZE];
+    mmsghdr msgs[BATCH_SIZE];
+
+    for(int begin = 0; begin < (int)sends.size(); begin += BATCH_SIZE)
+    {
+      int count = min<int>(BATCH_SIZE, sends.size() - begin);
+
+      for(int i = 0; i < count; ++i)
+      {
+        auto& send = sends[begin + i];
+        auto& data = send.match->packet.data;
+        iovs[i] = { data.data(), data.size() };
+        msgs[i] = {};
+        msgs[i].msg_hdr.msg_name = (void*)send.addr;
+        msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+      }
+
+      int sent = sendmmsg(fd, msgs, count, MSG_DONTWAIT);
+
+      for(int i = 0; i < sent; ++i)
+        stats.bytesOut += msgs[i].msg_len;
+
+      stats.packetsOut += max(sent, 0);
+    }
+  }
+
+  struct Join
+  {
+    sockaddr_in addr;
+    Seat seat;
+  };
+
+  struct Send
+  {
+    Match* match;
+    sockaddr_in const* addr;
+  };
+
+  int shardCount = 1;
+  Lobby& lobby;
+  int fd;
+  vector<Match*> matches; // match m is matches[m / shardCount] of shard m % shardCount
+  map<uint64_t, Match*> playerMatches; // by player address
+  int64_t tickCount = 0;
+  vector<Send> sends;
+  ShardStats stats;
+
+  mutex joinMutex;
+  vector<Join> joins; // queued by any shard
+  vector<Join> seating;
+};
+
+void pinToCore(thread& t, int core)
+{
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(core, &cpus);
+  pthread_setaffinity_np(t.native_handle(), sizeof cpus, &cpus);
+}
+
+void onSignal(int)
+{
+  g_running = false;
+}
+}
+
+int main(int argc, char* argv[])
+{
+  int port = NET_DEFAULT_PORT;
+  int matchCount = 64;
+  int shardCount = max(1u, thread::hardware_concurrency());
+  int seconds = 0;
+  GameConfig config;
+
+  for(int i = 1; i < argc; ++i)
+  {
+    string arg = argv[i];
+
+    if(arg == "--port" && i + 1 < argc)
+      port = atoi(argv[++i]);
+    else if(arg == "--matches" && i + 1 < argc)
+      matchCount = max(1, atoi(argv[++i]));
+    else if(arg == "--shards" && i + 1 < argc)
+      shardCount = max(1, atoi(argv[++i]));
+    else if(arg == "--seconds" && i + 1 < argc)
+      seconds = atoi(argv[++i]);
+    else if(arg == "--rate" && i + 1 < argc)
+      config.turnsPerSecond = max(1, atoi(argv[++i]));
+    else if(arg == "--speed" && i + 1 < argc)
+    {
+      config.speed = max(1, atoi(argv[++i]));
+      config.boostSpeed = config.speed * 2;
+    }
+    else if(arg == "--arena" && i + 1 < argc)
+    {
+      if(sscanf(argv[++i], "%dx%d", &config.width, &config.height) != 2 || config.width < 1 || config.height < 1
+         || config.width > NET_MAX_ARENA_SIZE || config.height > NET_MAX_ARENA_SIZE)
+      {
+        fprintf(stderr, "Invalid arena size: '%s'\n", argv[i]);
+        return 1;
+      }
+    }
+    else
+    {
+      fprintf(stderr, "Usage: %s [--port <port>] [--matches <count>] [--shards <count>]\n", argv[0]);
+      fprintf(stderr, "          [--arena <width>x<height>] [--rate <turns/s>] [--speed <cells/turn>]\n");
+      fprintf(stderr, "          [--seconds <duration>]\n");
+      return 1;
+    }
+  }
+
+  shardCount = min(shardCount, matchCount);
+
+  signal(SIGINT, &onSignal);
+  signal(SIGTERM, &onSignal);
+
+  try
+  {
+    Lobby lobby(matchCount);
+    vector<unique_ptr<Match>> matches;
+    vector<unique_ptr<Shard>> shards;
+    vector<Shard*> shardList;
+
+    for(int k = 0; k < shardCount; ++k)
+    {
+      shards.push_back(make_unique<Shard>(port + k, lobby));
+      shards[k]->shardCount = shardCount;
+      shardList.push_back(shards[k].get());
+    }
+
+    for(int m = 0; m < matchCount; ++m)
+    {
+      config.seed = m;
+      matches.push_back(make_unique<Match>(m, config));
+      shards[m % shardCount]->matches.push_back(matches[m].get());
+    }
+
+    printf("[server] %d matches of %dx%d, %d turns/s, on %d shards (UDP ports %d-%d)\n",
+           matchCount, config.width, config.height, config.turnsPerSecond, shardCount, port, port + shardCount - 1);
+
+    vector<thread> threads;
+    int coreCount = max(1u, thread::hardware_concurrency());
+
+    for(int k = 0; k < shardCount; ++k)
+    {
+      threads.emplace_back(&Shard::run, shards[k].get(), shardList, config.turnsPerSecond);
+      pinToCore(threads.back(), k % coreCount);
+    }
+
+    // statistics, once per second
+    vector<int64_t> lastTurns(shardCount), lastBusy(shardCount), lastBytes(shardCount);
+    auto last = chrono::steady_clock::now();
+
+    for(int elapsed = 0; g_running && (seconds == 0 || elapsed < seconds);)
+    {
+      this_thread::sleep_for(chrono::milliseconds(100));
+
+      auto now = chrono::steady_clock::now();
+      auto interval = chrono::duration<double>(now - last).count();
+
+      if(interval < 1.0)
+        continue;
+
+      last = now;
+      elapsed++;
+
+      int players = 0;
+      double turnsPerSecond = 0;
+      double bytesPerSecond = 0;
+      string load;
+
+      for(int k = 0; k < shardCount; ++k)
+      {
+        auto& stats = shards[k]->stats;
+        auto turns = stats.turns.load();
+        auto busy = stats.busyUs.load();
+        auto bytes = stats.bytesOut.load();
+
+        players += stats.players;
+        turnsPerSecond += (turns - lastTurns[k]) / interval;
+        bytesPerSecond += (bytes - lastBytes[k]) / interval;
+        load += " " + to_string((int)((busy - lastBusy[k]) / (interval * 10000))) + "%";
+
+        lastTurns[k] = turns;
+        lastBusy[k] = busy;
+        lastBytes[k] = bytes;
+      }
+
+      printf("[server] %d players, %.0f match turns/s, %.0f kB/s out, shard load:%s\n",
+             players, turnsPerSecond, bytesPerSecond / 1000, load.c_str());
+      fflush(stdout);
+    }
+
+    g_running = false;
+
+    for(auto& t : threads)
+      t.join();
+
+    int64_t missed = 0;
+
+    for(auto& shard : shards)
+      missed += shard->stats.missedTicks;
+
+    printf("[server] stopped, %lld ticks missed\n", (long long)missed);
+  }
+  catch(exception const& e)
+  {
+    fprintf(stderr, "Fatal: %s\n", e.what());
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,136 @@
+// Spectator viewer: displays the board delta stream emitted by the game.
+// Usage: spectate.exe <file|-|tcp:port>
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+#include "SDL.h"
+#include "display.h"
+#include "spectator.h"
+
+using namespace std;
+
+namespace
+{
+void drawFrame(SpectatorFrame const& frame, uint32_t* pixels)
+{
+  auto& board = *frame.board;
+  auto viewport = computeViewport(frame.bikes, board.width, board.height);
+
+  // position on screen, if visible
+  auto toScreen = [&] (int x, int y, int& sx, int& sy)
+    {
+      sx = ((x - viewport.x) % board.width + board.width) % board.width;
+      sy = ((y - viewport.y) % board.height + board.height) % board.height;
+      return sx < BOARD_WIDTH && sy < BOARD_HEIGHT;
+    };
+
+  fill(pixels, pixels + BOARD_WIDTH * BOARD_HEIGHT, 0);
+
+  for(int y = 0; y < min(board.height, BOARD_HEIGHT); ++y)
+  {
+    int by = (viewport.y + y) % board.height;
+
+    for(int x = 0; x < min(board.width, BOARD_WIDTH); ++x)
+      pixels[y * BOARD_WIDTH + x] = getColor(board.get((viewport.x + x) % board.width, by));
+  }
+
+  for(auto& ob : frame.obstacles)
+    for(int y = 0; y < ob.size.y; ++y)
+      for(int x = 0; x < ob.size.x; ++x)
+      {
+        int sx, sy;
+
+        if(toScreen(ob.pos.x + x, ob.pos.y + y, sx, sy))
+          pixels[sy * BOARD_WIDTH + sx] = -1;
+      }
+
+  for(int i = 0; i < MAX_PLAYERS; ++i)
+  {
+    auto& bike = frame.bikes[i];
+
+    if(!bike.alive)
+      continue;
+
+    int color = getColor(1 + i);
+    int darkColor = mkColor(((color >> 16) & 0xff) / 2, ((color >> 8) & 0xff) / 2, (color & 0xff) / 2);
+
+    for(int j = -2; j <= 2; ++j)
+      for(int k = -2; k <= 2; ++k)
+      {
+        int sx, sy;
+
+        if(toScreen(bike.pos.x - k, bike.pos.y - j, sx, sy))
+          pixels[sy * BOARD_WIDTH + sx] = darkColor;
+      }
+  }
+}
+
+bool userWantsToQuit()
+{
+  SDL_Event event;
+
+  while(SDL_PollEvent(&event))
+  {
+    if(event.type == SDL_QUIT)
+      return true;
+
+    if(event.type == SDL_KEYDOWN && event.key.keysym.scancode == SDL_SCANCODE_ESCAPE)
+      return true;
+  }
+
+  return false;
+}
+}
+
+int main(int argc, char* argv[])
+{
+  if(argc != 2)
+  {
+    fprintf(stderr, "Usage: %s <file|-|tcp:port>\n", argv[0]);
+    return 1;
+  }
+
+  try
+  {
+    auto fp = openSpectatorSource(argv[1]);
+
+    SDL_Init(SDL_INIT_VIDEO);
+    auto display = createDisplay(BOARD_WIDTH, BOARD_HEIGHT);
+
+    SpectatorFrame frame;
+    vector<uint32_t> pixels(BOARD_WIDTH * BOARD_HEIGHT);
+
+    double nextFrameTime = SDL_GetTicks();
+    int64_t lastRefresh = 0;
+
+    while(!userWantsToQuit() && readSpectatorFrame(fp, frame))
+    {
+      auto now = SDL_GetTicks();
+
+      // don't let a file play back faster than the game ran
+      if(nextFrameTime > now)
+        SDL_Delay(nextFrameTime - now);
+
+      nextFrameTime = max<double>(nextFrameTime, now) + 1000.0 / frame.turnsPerSecond;
+
+      if(now - lastRefresh >= 16)
+      {
+        drawFrame(frame, pixels.data());
+        display->refresh(pixels.data());
+        lastRefresh = now;
+      }
+    }
+
+    display.reset();
+    SDL_Quit();
+  }
+  catch(exception const& e)
+  {
+    fprintf(stderr, "Fatal: %s\n", e.what());
+    return 1;
+  }
+
+  return 0;
+}
+
@@ -0,0 +1,640 @@
+// Spectator delta stream: encoder (game side) and decoder (viewer side).
+#include "spectator.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace
+{
+// Stream layout (little-endian):
+//
+// header: "LRSP" version:u8
+// frame:  kind:u8 ('K' or 'D') frameCount:u32
+//         (keyframes only) arenaWidth:u16 arenaHeight:u16 turnsPerSecond:u32
+//         bikes: MAX_PLAYERS * { alive:u8 x:u16 y:u16 direction:u8 }
+//         obstacleCount:u16, obstacleCount * { x:u16 y:u16 w:i16 h:i16 }
+//         runCount:u32, runCount * { skip:varint length:varint value:u8 }
+//
+// 'skip' counts the cells left untouched since the end of the previous run,
+// in raster order. For keyframes, the runs cover the whole arena, with zero
+// skips.
+// Arenas wider or higher than 65535 cells can't be streamed.
+const char MAGIC[4] = { 'L', 'R', 'S', 'P' };
+const int VERSION = 4;
+const int MAX_ARENA_SIZE = 0xffff;
+const int KEYFRAME_INTERVAL = 1000; // in turns
+
+// Frames waiting to be sent. Beyond this, the viewer is too slow: new frames
+// are dropped, and the next one sent is a keyframe.
+const int MAX_PENDING_FRAMES = 256;
+
+// A viewer that doesn't read anything for this long is dropped.
+const int SEND_TIMEOUT_MS = 2000;
+
+struct Writer
+{
+  vector<uint8_t> data;
+
+  void u8(int val) { data.push_back(val); }
+  void u16(int val) { u8(val & 0xff); u8((val >> 8) & 0xff); }
+  void u32(uint32_t val) { u16(val & 0xffff); u16(val >> 16); }
+
+  void varint(uint32_t val)
+  {
+    while(val >= 0x80)
+    {
+      u8((val & 0x7f) | 0x80);
+      val >>= 7;
+    }
+
+    u8(val);
+  }
+};
+
+int connectTo(string hostAndPort)
+{
+  auto colon = hostAndPort.rfind(':');
+
+  if(colon == string::npos)
+    throw runtime_error("Invalid spectator address: '" + hostAndPort + "'");
+
+  auto host = hostAndPort.substr(0, colon);
+  auto port = hostAndPort.substr(colon + 1);
+
+  addrinfo hints {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  addrinfo* addr = nullptr;
+
+  if(getaddrinfo(host.c_str(), port.c_str(), &hints, &addr))
+    throw runtime_error("Can't resolve '" + host + "'");
+
+  int fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+
+  if(fd < 0 || connect(fd, addr->ai_addr, addr->ai_addrlen))
+  {
+    freeaddrinfo(addr);
+    throw runtime_error("Can't connect to '" + hostAndPort + "'");
+  }
+
+  freeaddrinfo(addr);
+
+  timeval timeout { SEND_TIMEOUT_MS / 1000, (SEND_TIMEOUT_MS % 1000) * 1000 };
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout);
+
+  return fd;
+}
+
+FILE* waitForConnection(string port)
+{
+  addrinfo hints {};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+
+  addrinfo* addr = nullptr;
+
+  if(getaddrinfo(nullptr, port.c_str(), &hints, &addr))
+    throw runtime_error("Invalid port: '" + port + "'");
+
+  int listener = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+  int yes = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof yes);
+
+  if(listener < 0 || bind(listener, addr->ai_addr, addr->ai_addrlen) || listen(listener, 1))
+  {
+    freeaddrinfo(addr);
+    throw runtime_error("Can't listen on port " + port);
+  }
+
+  freeaddrinfo(addr);
+
+  printf("[spectator] waiting for a game on port %s\n", port.c_str());
+  int fd = accept(listener, nullptr, nullptr);
+  close(listener);
+
+  if(fd < 0)
+    throw runtime_error("Can't accept connection");
+
+  return fdopen(fd, "rb");
+}
+
+// The frames are encoded on the game thread, and written by a thread of
+// their own: a slow viewer doesn't stall the game, and one that goes away is
+// dropped.
+struct SpectatorStream : ISpectator
+{
+  SpectatorStream(const char* dest)
+  {
+    if(!strcmp(dest, "-"))
+      fp = stdout;
+    else if(!strncmp(dest, "tcp:", 4))
+      fd = connectTo(dest + 4);
+    else
+      fp = fopen(dest, "wb");
+
+    if(!fp && fd < 0)
+      throw runtime_error(string("Can't open spectator stream: ") + dest);
+
+    worker = thread(&SpectatorStream::run, this);
+
+    Writer header;
+
+    for(auto c : MAGIC)
+      header.u8(c);
+
+    header.u8(VERSION);
+    flush(header);
+
+    onNewRound(BOARD_WIDTH, BOARD_HEIGHT, GameConfig().turnsPerSecond);
+  }
+
+  ~SpectatorStream()
+  {
+    {
+      unique_lock<mutex> lock(m_mutex);
+      quit = true;
+    }
+
+    wakeUp.notify_one();
+    worker.join();
+
+    if(fd >= 0)
+      close(fd);
+    else if(fp != stdout)
+      fclose(fp);
+
+    if(dropped)
+      printf("[spectator] %d frames dropped\n", dropped);
+  }
+
+  void onNewRound(int width, int height, int turnsPerSecond_) override
+  {
+    if(width > MAX_ARENA_SIZE || height > MAX_ARENA_SIZE)
+    {
+      if(!failed)
+        printf("[spectator] a %dx%d arena doesn't fit the stream format, stream stopped\n", width, height);
+
+      failed = true;
+      return;
+    }
+
+    turnsPerSecond = turnsPerSecond_;
+    board = make_unique<Board>(width, height);
+    sent = make_unique<Board>(width, height);
+    dirty.assign(height, {});
+    row.resize(width);
+    sentRow.resize(width);
+    needKeyframe = true;
+  }
+
+  void onCell(Vec2 pos, int team) override
+  {
+    if(failed)
+      return;
+
+    board->set(pos.x, pos.y, team);
+    markDirty(pos.y, pos.x, pos.x + 1);
+  }
+
+  void onErase(Vec2 pos, Vec2 size) override
+  {
+    if(failed || size.x <= 0 || size.y <= 0)
+      return;
+
+    board->eraseRectangle(pos.x, pos.y, size.x, size.y);
+
+    for(int y = 0; y < min(size.y, board->height); ++y)
+    {
+      int row = (pos.y + y) % board->height;
+
+      if(pos.x + size.x > board->width)
+        markDirty(row, 0, board->width);
+      else
+        markDirty(row, pos.x, pos.x + size.x);
+    }
+  }
+
+  void onFrame(int frameCount, Bike const* bikes, vector<Obstacle> const& obstacles) override
+  {
+    if(failed)
+      return;
+
+    if(frameCount - lastKeyframe >= KEYFRAME_INTERVAL)
+      needKeyframe = true;
+
+    {
+      unique_lock<mutex> lock(m_mutex);
+
+      // the deltas are relative to the frames sent: after a gap, the viewer
+      // needs a keyframe
+      if(pending.size() >= MAX_PENDING_FRAMES)
+      {
+        dropped++;
+        needKeyframe = true;
+
+        for(auto& d : dirty)
+          d = {};
+
+        return;
+      }
+    }
+
+    Writer w;
+    w.u8(needKeyframe ? 'K' : 'D');
+    w.u32(frameCount);
+
+    if(needKeyframe)
+    {
+      w.u16(board->width);
+      w.u16(board->height);
+      w.u32(turnsPerSecond);
+    }
+
+    for(int i = 0; i < MAX_PLAYERS; ++i)
+    {
+      w.u8(bikes[i].alive);
+      w.u16(bikes[i].pos.x);
+      w.u16(bikes[i].pos.y);
+      w.u8((int)bikes[i].direction);
+    }
+
+    int obstacleCount = min<int>(obstacles.size(), 0xffff);
+    w.u16(obstacleCount);
+
+    for(int i = 0; i < obstacleCount; ++i)
+    {
+      auto& ob = obstacles[i];
+      w.u16(ob.pos.x);
+      w.u16(ob.pos.y);
+      w.u16(clamp(ob.size.x, -0x8000, 0x7fff));
+      w.u16(clamp(ob.size.y, -0x8000, 0x7fff));
+    }
+
+    Writer runs;
+    int runCount;
+
+    if(needKeyframe)
+    {
+      runCount = encodeKeyframe(runs);
+      lastKeyframe = frameCount;
+      needKeyframe = false;
+    }
+    else
+    {
+      runCount = encodeDelta(runs);
+    }
+
+    w.u32(runCount);
+    w.data.insert(w.data.end(), runs.data.begin(), runs.data.end());
+    flush(w);
+
+    for(auto& d : dirty)
+      d = {};
+  }
+
+  int encodeKeyframe(Writer& w)
+  {
+    int runCount = 0;
+    int runValue = 0;
+    uint32_t runLength = 0;
+
+    sent->clear();
+
+    for(int y = 0; y < board->height; ++y)
+    {
+      board->readRow(0, y, board->width, row.data());
+
+      for(int x = 0; x < board->width; ++x)
+      {
+        if(row[x] != runValue)
+        {
+          if(runLength)
+          {
+            w.varint(0);
+            w.varint(runLength);
+            w.u8(runValue);
+            ++runCount;
+          }
+
+          runValue = row[x];
+          runLength = 0;
+        }
+
+        ++runLength;
+
+        if(row[x])
+          sent->set(x, y, row[x]);
+      }
+    }
+
+    w.varint(0);
+    w.varint(runLength);
+    w.u8(runValue);
+
+    return runCount + 1;
+  }
+
+  // Sends the cells that differ from what the viewer already has.
+  int encodeDelta(Writer& w)
+  {
+    int runCount = 0;
+    uint32_t cursor = 0;
+
+    for(int y = 0; y < board->height; ++y)
+    {
+      auto span = dirty[y];
+
+      if(span.begin == span.end)
+        continue;
+
+      board->readRow(span.begin, y, span.end - span.begin, row.data());
+      sent->readRow(span.begin, y, span.end - span.begin, sentRow.data());
+
+      int x = span.begin;
+
+      while(x < span.end)
+      {
+        int k = x - span.begin;
+
+        if(row[k] == sentRow[k])
+        {
+          ++x;
+          continue;
+        }
+
+        int len = 1;
+
+        while(x + len < span.end && row[k + len] == row[k] && row[k + len] != sentRow[k + len])
+          ++len;
+
+        uint32_t i = (uint32_t)y * board->width + x;
+        w.varint(i - cursor);
+        w.varint(len);
+        w.u8(row[k]);
+        ++runCount;
+
+        for(int j = 0; j < len; ++j)
+          sent->set(x + j, y, row[k]);
+
+        cursor = i + len;
+        x += len;
+      }
+    }
+
+    return runCount;
+  }
+
+  void markDirty(int y, int begin, int end)
+  {
+    auto& span = dirty[y];
+
+    if(span.begin == span.end)
+    {
+      span = { begin, end };
+    }
+    else
+    {
+      span.begin = min(span.begin, begin);
+      span.end = max(span.end, end);
+    }
+  }
+
+  void flush(Writer& w)
+  {
+    {
+      unique_lock<mutex> lock(m_mutex);
+      pending.push_back(move(w.data));
+    }
+
+    wakeUp.notify_one();
+  }
+
+  void run()
+  {
+    while(true)
+    {
+      vector<uint8_t> data;
+
+      {
+        unique_lock<mutex> lock(m_mutex);
+        wakeUp.wait(lock, [&] { return quit || !pending.empty(); });
+
+        if(pending.empty())
+          break;
+
+        data = move(pending.front());
+        pending.pop_front();
+      }
+
+      if(!failed && !send(data))
+      {
+        printf("[spectator] can't write to the viewer, stream stopped\n");
+        failed = true;
+      }
+    }
+  }
+
+  bool send(vector<uint8_t> const& data)
+  {
+    if(fd < 0)
+      return fwrite(data.data(), 1, data.size(), fp) == data.size() && !fflush(fp);
+
+    size_t pos = 0;
+
+    while(pos < data.size())
+    {
+      // no SIGPIPE when the viewer is gone: the error is handled
+      auto n = ::send(fd, data.data() + pos, data.size() - pos, MSG_NOSIGNAL);
+
+      if(n < 0 && errno == EINTR)
+        continue;
+
+      if(n <= 0)
+        return false;
+
+      pos += n;
+    }
+
+    return true;
+  }
+
+  struct Span
+  {
+    int begin, end;
+  };
+
+  FILE* fp = nullptr;
+  int fd = -1; // for tcp
+  int turnsPerSecond;
+  unique_ptr<Board> board;
+  unique_ptr<Board> sent; // what the viewer has
+  vector<Span> dirty; // per row
+  vector<char> row, sentRow;
+  int lastKeyframe = 0;
+  bool needKeyframe = true;
+  int dropped = 0;
+
+  thread worker;
+  mutex m_mutex;
+  condition_variable wakeUp;
+  deque<vector<uint8_t>> pending;
+  bool quit = false;
+  atomic<bool> failed { false };
+};
+
+struct Reader
+{
+  FILE* fp;
+  bool ok = true;
+
+  int u8()
+  {
+    int c = fgetc(fp);
+
+    if(c == EOF)
+    {
+      ok = false;
+      return 0;
+    }
+
+    return c;
+  }
+
+  int u16() { int lo = u8(); return lo | (u8() << 8); }
+  int s16() { return (int16_t)u16(); }
+  uint32_t u32() { uint32_t lo = u16(); return lo | ((uint32_t)u16() << 16); }
+
+  uint32_t varint()
+  {
+    uint32_t val = 0;
+
+    for(int shift = 0; ok && shift < 32; shift += 7)
+    {
+      int c = u8();
+      val |= (c & 0x7f) << shift;
+
+      if(!(c & 0x80))
+        break;
+    }
+
+    return val;
+  }
+};
+}
+
+std::unique_ptr<ISpectator> createSpectatorStream(const char* dest)
+{
+  return std::make_unique<SpectatorStream>(dest);
+}
+
+FILE* openSpectatorSource(const char* src)
+{
+  FILE* fp;
+
+  if(!strcmp(src, "-"))
+    fp = stdin;
+  else if(!strncmp(src, "tcp:", 4))
+    fp = waitForConnection(src + 4);
+  else
+    fp = fopen(src, "rb");
+
+  if(!fp)
+    throw runtime_error(string("Can't open spectator stream: ") + src);
+
+  Reader r { fp };
+  char magic[4];
+
+  for(auto& c : magic)
+    c = r.u8();
+
+  int version = r.u8();
+
+  if(!r.ok || memcmp(magic, MAGIC, 4) || version != VERSION)
+    throw runtime_error(string("Not a spectator stream: ") + src);
+
+  return fp;
+}
+
+bool readSpectatorFrame(FILE* fp, SpectatorFrame& frame)
+{
+  Reader r { fp };
+
+  int kind = r.u8();
+  frame.frameCount = r.u32();
+
+  if(kind == 'K')
+  {
+    int width = r.u16();
+    int height = r.u16();
+    frame.turnsPerSecond = r.u32();
+
+    if(!r.ok || !width || !height || !frame.turnsPerSecond)
+      return false;
+
+    frame.board = make_unique<Board>(width, height);
+  }
+  else if(kind != 'D' || !frame.board)
+  {
+    return false;
+  }
+
+  for(auto& bike : frame.bikes)
+  {
+    bike.alive = r.u8();
+    bike.pos.x = r.u16();
+    bike.pos.y = r.u16();
+    bike.direction = (Direction)r.u8();
+  }
+
+  frame.obstacles.resize(r.u16());
+
+  for(auto& ob : frame.obstacles)
+  {
+    ob.pos.x = r.u16();
+    ob.pos.y = r.u16();
+    ob.size.x = r.s16();
+    ob.size.y = r.s16();
+    ob.solid = true;
+  }
+
+  auto runCount = r.u32();
+  auto& board = *frame.board;
+  int64_t cursor = 0;
+
+  for(uint32_t k = 0; k < runCount && r.ok; ++k)
+  {
+    cursor += r.varint();
+    int64_t len = r.varint();
+    int value = r.u8();
+
+    if(cursor + len > (int64_t)board.width * board.height)
+      return false; // corrupted stream
+
+    // fresh keyframe boards are empty already
+    if(value || kind == 'D')
+    {
+      for(int64_t i = cursor; i < cursor + len; ++i)
+        board.set(i % board.width, i / board.width, value);
+    }
+
+    cursor += len;
+  }
+
+  return r.ok;
+}
+
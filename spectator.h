@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdio>
+#include <memory>
+#include <vector>
+#include "board.h"
+#include "game.h"
+
+// Compact delta stream of the board, for spectator screens.
+//
+// Each turn, only the cells that changed since the previous frame are sent,
+// as RLE runs. A full RLE keyframe is sent at the start of each round, and
+// periodically, so a viewer can (re)synchronize.
+//
+// 'dest' is a file path, "-" for stdout, or "tcp:host:port".
+std::unique_ptr<ISpectator> createSpectatorStream(const char* dest);
+
+// Viewer side: reconstructs the frames from the stream.
+struct SpectatorFrame
+{
+  int frameCount = 0;
+  int turnsPerSecond = 0; // the game emits one frame per turn
+  std::unique_ptr<Board> board; // created by the first keyframe
+  Bike bikes[MAX_PLAYERS];
+  std::vector<Obstacle> obstacles;
+};
+
+// 'src' is a file path, "-" for stdin, or "tcp:port" to wait for a game to connect.
+FILE* openSpectatorSource(const char* src);
+
+// Returns false at the end of the stream.
+bool readSpectatorFrame(FILE* fp, SpectatorFrame& frame);
+
@@ -0,0 +1,159 @@
+// Analytics tool: aggregates the rounds of an analytics file.
+// Usage: stats.exe <file>                       per-bike averages
+//        stats.exe <file> --heatmap <out.pgm>   also dumps the heatmap
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "analytics.h"
+
+using namespace std;
+
+namespace
+{
+const char* const metricNames[METRIC_COUNT] =
+{
+  "lifetime",
+  "turns",
+  "kills",
+  "suicides",
+  "crashes",
+  "cells",
+  "wins",
+};
+
+int64_t sum(const int32_t* values, int count)
+{
+  int64_t r = 0;
+
+  for(int i = 0; i < count; ++i)
+    r += values[i];
+
+  return r;
+}
+
+void printAverages(IAnalyticsFile& file)
+{
+  int64_t totals[METRIC_COUNT][MAX_PLAYERS] {};
+  int64_t rounds = 0;
+  int64_t turns = 0;
+
+  for(int b = 0; b < file.blockCount(); ++b)
+  {
+    auto block = file.block(b);
+    rounds += block.roundCount;
+    turns += sum(block.length, block.roundCount);
+
+    for(int m = 0; m < METRIC_COUNT; ++m)
+      for(int i = 0; i < MAX_PLAYERS; ++i)
+        totals[m][i] += sum(block.columns[m][i], block.roundCount);
+  }
+
+  printf("%lld rounds, %.1f turns per round\n", (long long)rounds, rounds ? (double)turns / rounds : 0.0);
+
+  if(rounds == 0)
+    return;
+
+  printf("%-10s", "per round");
+
+  for(int i = 0; i < MAX_PLAYERS; ++i)
+    printf(" %10s%d", "bike ", 1 + i);
+
+  printf("\n");
+
+  for(int m = 0; m < METRIC_COUNT; ++m)
+  {
+    printf("%-10s", metricNames[m]);
+
+    for(int i = 0; i < MAX_PLAYERS; ++i)
+      printf(" %11.3f", (double)totals[m][i] / rounds);
+
+    printf("\n");
+  }
+}
+
+// Sums the heatmaps of the first arena size, and writes them as a
+// greyscale image, scaled to the hottest cell.
+void dumpHeatmap(IAnalyticsFile& file, const char* path)
+{
+  if(file.heatmapCount() == 0)
+    throw runtime_error("No heatmap in the file");
+
+  int width = file.heatmap(0).width;
+  int height = file.heatmap(0).height;
+  vector<uint32_t> counts(width * height);
+  int rounds = 0;
+
+  for(int k = 0; k < file.heatmapCount(); ++k)
+  {
+    auto heatmap = file.heatmap(k);
+
+    if(heatmap.width != width || heatmap.height != height)
+      continue;
+
+    for(int i = 0; i < width * height; ++i)
+      counts[i] += heatmap.counts[i];
+
+    rounds += heatmap.roundCount;
+  }
+
+  uint32_t hottest = 0;
+
+  for(auto count : counts)
+    hottest = max(hottest, count);
+
+  auto fp = fopen(path, "wb");
+
+  if(!fp)
+    throw runtime_error(string("Can't open '") + path + "' for writing");
+
+  fprintf(fp, "P5\n%d %d\n255\n", width, height);
+
+  vector<uint8_t> row(width);
+
+  for(int y = 0; y < height; ++y)
+  {
+    for(int x = 0; x < width; ++x)
+      row[x] = counts[y * width + x] * 255ull / max(hottest, 1u);
+
+    fwrite(row.data(), 1, width, fp);
+  }
+
+  fclose(fp);
+
+  printf("heatmap: %dx%d over %d rounds, hottest cell taken in %u rounds, written to '%s'\n", width, height, rounds, hottest, path);
+}
+}
+
+int main(int argc, char* argv[])
+{
+  if(argc != 2 && !(argc == 4 && !strcmp(argv[2], "--heatmap")))
+  {
+    fprintf(stderr, "Usage: %s <file> [--heatmap <out.pgm>]\n", argv[0]);
+    return 1;
+  }
+
+  try
+  {
+    auto start = chrono::steady_clock::now();
+    auto file = openAnalyticsFile(argv[1]);
+
+    printAverages(*file);
+
+    auto elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    printf("[stats] %d blocks aggregated in %.1f ms\n", file->blockCount(), elapsed);
+
+    if(argc == 4)
+      dumpHeatmap(*file, argv[3]);
+  }
+  catch(exception const& e)
+  {
+    fprintf(stderr, "Fatal: %s\n", e.what());
+    return 1;
+  }
+
+  return 0;
+}
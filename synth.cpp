@@ -0,0 +1,45 @@
+#include "synth.h"
+#include <cmath>
+
+namespace
+{
+double mySin(double t)
+{
+  return sin(t * 2 * M_PI);
+}
+
+double mySquare(double t)
+{
+  return t < 0.5 ? -1 : 1;
+}
+}
+
+void Synth::mixAudio(float* samples, int sampleCount)
+{
+  for(int i=0;i < sampleCount;++i)
+  {
+    m_lfophase += 10.0 / SAMPLE_RATE;
+    if(m_lfophase > 1.0)
+      m_lfophase -= 1.0;
+
+    auto freq = m_sineFreq + mySin(m_lfophase) * 20;
+
+    m_phase1 += freq / SAMPLE_RATE;
+    if(m_phase1 > 1.0)
+      m_phase1 -= 1.0;
+
+    m_phase2 += freq * 1.5 / SAMPLE_RATE;
+    if(m_phase2 > 1.0)
+      m_phase2 -= 1.0;
+
+    m_env *= m_decay;
+
+    double osc = 0.0;
+
+    osc += mySquare(m_phase1);
+    osc += mySquare(m_phase2);
+
+    samples[i] = osc * m_env * 0.3;
+  }
+}
+
@@ -0,0 +1,27 @@
+#pragma once
+
+// The sound generator, independent from the audio output.
+struct Synth
+{
+  static auto const SAMPLE_RATE = 48000;
+
+  // Restarts the note, at pitch 'freq'. 'decay' is the envelope
+  // multiplier per sample: the closer to 1, the longer the note.
+  void beep(double freq = 440.0, double decay = 0.9999)
+  {
+    m_sineFreq = freq;
+    m_decay = decay;
+    m_env = 1.0;
+  }
+
+  // Writes 'sampleCount' mono samples.
+  void mixAudio(float* samples, int sampleCount);
+
+  double m_phase1 = 0;
+  double m_phase2 = 0;
+  double m_lfophase = 0;
+  double m_sineFreq = 440.0;
+  double m_decay = 0.9999;
+  double m_env = 0;
+};
+
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "display.h"
+#include "game.h"
+
+// Collects the game sprites as quads, for the display to draw over the
+// trails: the pixel buffer only ever holds the trails.
+struct Terminal : ITerminal
+{
+  void drawHead(Vec2 pos, int colorIndex) override
+  {
+    addQuad(pos.x - 2, pos.y - 2, 5, 5, darken(getColor(colorIndex)));
+  }
+
+  void drawObstacle(Vec2 pos, Vec2 size) override
+  {
+    addQuad(pos.x, pos.y, size.x, size.y, -1);
+  }
+
+  void drawBar(Vec2 pos, Vec2 size, int colorIndex) override
+  {
+    addQuad(pos.x, pos.y, size.x, size.y, getColor(colorIndex));
+  }
+
+  static int darken(int color)
+  {
+    int r = (color >> 16) & 0xff;
+    int g = (color >> 8) & 0xff;
+    int b = (color >> 0) & 0xff;
+    return mkColor(r / 2, g / 2, b / 2);
+  }
+
+  // Wraps around the screen edges, by splitting the quad.
+  void addQuad(int x, int y, int w, int h, int color)
+  {
+    if(w <= 0 || h <= 0)
+      return;
+
+    w = std::min(w, BOARD_WIDTH);
+    h = std::min(h, BOARD_HEIGHT);
+    x = (x % BOARD_WIDTH + BOARD_WIDTH) % BOARD_WIDTH;
+    y = (y % BOARD_HEIGHT + BOARD_HEIGHT) % BOARD_HEIGHT;
+
+    int w1 = std::min(w, BOARD_WIDTH - x);
+    int h1 = std::min(h, BOARD_HEIGHT - y);
+
+    auto add = [&] (int qx, int qy, int qw, int qh)
+      {
+        if(qw > 0 && qh > 0)
+          quads.push_back({ (int16_t)qx, (int16_t)qy, (int16_t)qw, (int16_t)qh, (uint32_t)color });
+      };
+
+    add(x, y, w1, h1);
+    add(0, y, w - w1, h1);
+    add(x, 0, w1, h - h1);
+    add(0, 0, w - w1, h - h1);
+  }
+
+  uint32_t pixels[BOARD_WIDTH * BOARD_HEIGHT];
+  std::vector<Quad> quads; // cleared by the owner, once presented
+};
+
@@ -0,0 +1,92 @@
+#include "threadpool.h"
+
+using namespace std;
+
+ThreadPool::ThreadPool(int threadCount)
+{
+  if(threadCount <= 0)
+    threadCount = max(1u, thread::hardware_concurrency());
+
+  for(int i = 1; i < threadCount; ++i)
+    workers.emplace_back(&ThreadPool::workerMain, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    unique_lock<mutex> lock(m_mutex);
+    m_quit = true;
+  }
+
+  wakeUp.notify_all();
+
+  for(auto& worker : workers)
+    worker.join();
+}
+
+void ThreadPool::run(int count, void (*func)(void*, int), void* ctx)
+{
+  if(workers.empty() || count <= 1)
+  {
+    for(int i = 0; i < count; ++i)
+      func(ctx, i);
+
+    return;
+  }
+
+  {
+    unique_lock<mutex> lock(m_mutex);
+    m_func = func;
+    m_ctx = ctx;
+    m_count = count;
+    m_next = 0;
+    m_busyWorkers = workers.size();
+    m_generation++;
+  }
+
+  wakeUp.notify_all();
+
+  work();
+
+  unique_lock<mutex> lock(m_mutex);
+  done.wait(lock, [&] { return m_busyWorkers == 0; });
+}
+
+void ThreadPool::workerMain()
+{
+  int generation = 0;
+
+  while(true)
+  {
+    {
+      unique_lock<mutex> lock(m_mutex);
+      wakeUp.wait(lock, [&] { return m_quit || m_generation != generation; });
+
+      if(m_quit)
+        return;
+
+      generation = m_generation;
+    }
+
+    work();
+
+    unique_lock<mutex> lock(m_mutex);
+
+    if(--m_busyWorkers == 0)
+      done.notify_one();
+  }
+}
+
+void ThreadPool::work()
+{
+  while(true)
+  {
+    int i = m_next++;
+
+    if(i >= m_count)
+      break;
+
+    m_func(m_ctx, i);
+  }
+}
+
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent worker threads, for data-parallel loops.
+// The calling thread takes part in the work, and 'parallelFor' returns once
+// all the items have been processed (i.e it's a barrier).
+struct ThreadPool
+{
+  // 0 means one thread per core.
+  ThreadPool(int threadCount = 0);
+  ~ThreadPool();
+
+  // Calls job(i) for each i in [0, count), no allocation.
+  template<typename Job>
+  void parallelFor(int count, Job& job)
+  {
+    auto trampoline = [] (void* ctx, int i) { (*(Job*)ctx)(i); };
+    run(count, trampoline, &job);
+  }
+
+  int size() const { return (int)workers.size() + 1; }
+
+private:
+  void run(int count, void (*func)(void*, int), void* ctx);
+  void workerMain();
+  void work();
+
+  std::vector<std::thread> workers;
+  std::mutex m_mutex;
+  std::condition_variable wakeUp;
+  std::condition_variable done;
+
+  // current batch
+  void (*m_func)(void*, int) = nullptr;
+  void* m_ctx = nullptr;
+  int m_count = 0;
+  std::atomic<int> m_next { 0 };
+  int m_busyWorkers = 0;
+  int m_generation = 0;
+  bool m_quit = false;
+};
+
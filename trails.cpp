@@ -0,0 +1,318 @@
+#include "trails.h"
+#include <algorithm>
+
+using namespace std;
+
+namespace
+{
+auto const BAND_BITS = 6;
+
+// Calls func(band) once for each band covering [pos, pos + len), wrapping
+// around the edge.
+template<typename Func>
+void forEachBand(int pos, int len, int mod, Func func)
+{
+  int bandCount = ((mod - 1) >> BAND_BITS) + 1;
+
+  if(len >= mod)
+  {
+    for(int k = 0; k < bandCount; ++k)
+      func(k);
+
+    return;
+  }
+
+  int end = min(pos + len, mod);
+
+  for(int k = pos >> BAND_BITS; k <= (end - 1) >> BAND_BITS; ++k)
+    func(k);
+
+  // the wrapped part: its last band can be the first one above
+  for(int k = 0; k <= (pos + len - mod - 1) >> BAND_BITS && k < pos >> BAND_BITS; ++k)
+    func(k);
+}
+
+Vec2 delta(Direction direction)
+{
+  switch(direction)
+  {
+  case Direction::Left: return { -1, 0 };
+  case Direction::Down: return { 0, 1 };
+  case Direction::Right: return { 1, 0 };
+  case Direction::Up: return { 0, -1 };
+  default: return { 0, 0 };
+  }
+}
+
+int wrap(int val, int mod)
+{
+  return (val % mod + mod) % mod;
+}
+
+int ceilDiv(int num, int den)
+{
+  return num >= 0 ? (num + den - 1) / den : -(-num / den);
+}
+}
+
+Trails::Trails(int width_, int height_) : width(width_), height(height_)
+{
+}
+
+void Trails::clear()
+{
+  for(int i = 0; i < MAX_PLAYERS; ++i)
+  {
+    trails[i].clear();
+    unchanged[i] = 0;
+  }
+}
+
+void Trails::markUnchanged()
+{
+  for(int i = 0; i < MAX_PLAYERS; ++i)
+    unchanged[i] = (int)trails[i].size();
+}
+
+void Trails::restore(int team, const TrailSegment* segments, int count)
+{
+  auto& trail = trails[team - 1];
+  int keep = min({ unchanged[team - 1], (int)trail.size(), count });
+
+  trail.erase(trail.begin() + keep, trail.end());
+  trail.insert(trail.end(), segments + keep, segments + count);
+  unchanged[team - 1] = count;
+}
+
+void Trails::onMove(int team, Vec2 pos, Direction direction, int step)
+{
+  // a lone cell has no direction, give it one
+  if(direction == Direction::Idle)
+    direction = Direction::Right;
+
+  auto& trail = trails[team - 1];
+
+  if(!trail.empty())
+  {
+    auto& last = trail.back();
+
+    if(cellOf(last, last.count - 1) == pos)
+      return; // didn't move
+
+    int mod = delta(direction).y == 0 ? width : height;
+
+    // a segment never overlaps itself around the torus
+    bool continues = last.direction == direction && last.step == step && (last.count + 1) * step <= mod;
+
+    if(continues && cellOf(last, last.count) == pos)
+    {
+      last.count++;
+      unchanged[team - 1] = min(unchanged[team - 1], (int)trail.size() - 1);
+      return;
+    }
+  }
+
+  trail.push_back({ pos, direction, step, 1 });
+}
+
+void Trails::erase(Vec2 pos, Vec2 size)
+{
+  if(size.x <= 0 || size.y <= 0)
+    return;
+
+  Board::Rect rect { pos.x, pos.y, size.x, size.y };
+  eraseRectangles(&rect, 1);
+}
+
+void Trails::eraseRectangles(Board::Rect const* rects, int count)
+{
+  indexBands(rects, count, true, rowBands);
+  indexBands(rects, count, false, columnBands);
+
+  for(int i = 0; i < MAX_PLAYERS; ++i)
+  {
+    auto& trail = trails[i];
+    scratch.clear();
+
+    for(int j = 0; j < (int)trail.size(); ++j)
+    {
+      auto& s = trail[j];
+      bool horizontal = delta(s.direction).y == 0;
+      auto& index = horizontal ? rowBands : columnBands;
+      int line = horizontal ? s.start.y : s.start.x;
+      int mod = horizontal ? height : width;
+      bool split = false;
+
+      for(int k = index.start[line >> BAND_BITS]; k < index.start[(line >> BAND_BITS) + 1]; ++k)
+      {
+        auto& r = rects[index.items[k]];
+
+        // the band is coarse: most of its rectangles miss the line
+        if(wrap(line - (horizontal ? r.y : r.x), mod) >= (horizontal ? r.h : r.w))
+          continue;
+
+        if(!split)
+        {
+          pieces.assign(1, s);
+          split = true;
+        }
+
+        clipped.clear();
+
+        for(auto& piece : pieces)
+          clip(piece, { r.x, r.y }, { r.w, r.h }, clipped);
+
+        pieces.swap(clipped);
+      }
+
+      if(split)
+      {
+        scratch.insert(scratch.end(), pieces.begin(), pieces.end());
+        unchanged[i] = min(unchanged[i], j);
+      }
+      else
+        scratch.push_back(s);
+    }
+
+    trail.swap(scratch);
+  }
+}
+
+// Counting sort of the rectangles by band.
+void Trails::indexBands(Board::Rect const* rects, int count, bool rows, BandIndex& index) const
+{
+  int mod = rows ? height : width;
+  int bandCount = ((mod - 1) >> BAND_BITS) + 1;
+
+  index.start.assign(bandCount + 1, 0);
+
+  auto forEachBandOf = [&] (Board::Rect const& r, auto func)
+    {
+      if(r.w > 0 && r.h > 0)
+        forEachBand(rows ? r.y : r.x, rows ? r.h : r.w, mod, func);
+    };
+
+  for(int i = 0; i < count; ++i)
+    forEachBandOf(rects[i], [&] (int band) { index.start[band + 1]++; });
+
+  for(int k = 1; k <= bandCount; ++k)
+    index.start[k] += index.start[k - 1];
+
+  index.items.resize(index.start.back());
+
+  // fill, using start[band] as the insertion point: it ends up at the
+  // start of the next band
+  for(int i = 0; i < count; ++i)
+    forEachBandOf(rects[i], [&] (int band) { index.items[index.start[band]++] = i; });
+
+  for(int k = bandCount; k > 0; --k)
+    index.start[k] = index.start[k - 1];
+
+  index.start[0] = 0;
+}
+
+int Trails::owner(Vec2 pos) const
+{
+  for(int i = 0; i < MAX_PLAYERS; ++i)
+    for(auto& s : trails[i])
+      if(covers(s, pos))
+        return i + 1;
+
+  return 0;
+}
+
+int Trails::length(int team) const
+{
+  int total = 0;
+
+  for(auto& s : trails[team - 1])
+    total += s.count;
+
+  return total;
+}
+
+Vec2 Trails::cellOf(TrailSegment const& s, int k) const
+{
+  auto d = delta(s.direction);
+  return { wrap(s.start.x + d.x * s.step * k, width), wrap(s.start.y + d.y * s.step * k, height) };
+}
+
+bool Trails::covers(TrailSegment const& s, Vec2 pos) const
+{
+  auto d = delta(s.direction);
+  bool horizontal = d.y == 0;
+
+  if(horizontal ? pos.y != s.start.y : pos.x != s.start.x)
+    return false;
+
+  int mod = horizontal ? width : height;
+  int sign = horizontal ? d.x : d.y;
+  int offset = wrap(((horizontal ? pos.x - s.start.x : pos.y - s.start.y)) * sign, mod);
+
+  return offset % s.step == 0 && offset / s.step < s.count;
+}
+
+void Trails::clip(TrailSegment const& s, Vec2 rectPos, Vec2 rectSize, vector<TrailSegment>& out) const
+{
+  auto d = delta(s.direction);
+  bool horizontal = d.y == 0;
+
+  // does the line of the segment cross the rectangle at all?
+  {
+    int mod = horizontal ? height : width;
+    int line = horizontal ? s.start.y : s.start.x;
+    int begin = horizontal ? rectPos.y : rectPos.x;
+    int size = horizontal ? rectSize.y : rectSize.x;
+
+    if(wrap(line - begin, mod) >= size)
+    {
+      out.push_back(s);
+      return;
+    }
+  }
+
+  int mod = horizontal ? width : height;
+  int sign = horizontal ? d.x : d.y;
+  int start = horizontal ? s.start.x : s.start.y;
+  int begin = horizontal ? rectPos.x : rectPos.y;
+  int size = min(horizontal ? rectSize.x : rectSize.y, mod);
+
+  // mirror the axis, so the segment always goes forward
+  if(sign < 0)
+  {
+    start = -start;
+    begin = -begin - size + 1;
+  }
+
+  // cell 'k' lies at 'offset + step * k' from the rectangle start: it's erased
+  // when that falls inside [j * mod, j * mod + size), for some j.
+  int offset = wrap(start - begin, mod);
+
+  auto keep = [&] (int k0, int k1)
+    {
+      auto piece = s;
+      piece.start = cellOf(s, k0);
+      piece.count = k1 - k0;
+      out.push_back(piece);
+    };
+
+  int k = 0;
+
+  for(int j = 0; k < s.count; ++j)
+  {
+    int eraseBegin = max(0, ceilDiv(j * mod - offset, s.step));
+    int eraseEnd = min(s.count, ceilDiv(j * mod - offset + size, s.step));
+
+    if(eraseBegin >= s.count)
+      break;
+
+    if(eraseBegin > k)
+      keep(k, eraseBegin);
+
+    k = max(k, eraseEnd);
+  }
+
+  if(k < s.count)
+    keep(k, s.count);
+}
+
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <vector>
+#include "board.h" // Board::Rect
+#include "game.h" // Vec2, Direction
+
+// The trails of the bikes, as lists of axis-aligned segments.
+// A bike going straight only extends its last segment: a new one is only
+// appended when it turns (or changes speed), so the cost of the queries
+// grows with the number of turns, not with the number of cells.
+struct TrailSegment
+{
+  Vec2 start;
+  Direction direction;
+  int step; // distance between two cells of the segment
+  int count; // number of cells
+};
+
+struct Trails
+{
+  Trails(int width, int height);
+
+  void clear();
+
+  // Bike 'team' has claimed the cell 'pos', moving 'step' cells in 'direction'.
+  void onMove(int team, Vec2 pos, Direction direction, int step);
+
+  // Clips the segments to the outside of the rectangle (which wraps around the edges).
+  void erase(Vec2 pos, Vec2 size);
+
+  // Same as erase() for each rectangle in turn, in one pass over the
+  // segments: each one is only clipped by the rectangles crossing its band
+  // of rows (or columns, if vertical), not by all of them.
+  void eraseRectangles(Board::Rect const* rects, int count);
+
+  // Returns the team whose trail covers 'pos', or 0.
+  int owner(Vec2 pos) const;
+
+  // Returns the number of cells covered by the trail of 'team'.
+  int length(int team) const;
+
+  std::vector<TrailSegment> const& segments(int team) const
+  {
+    return trails[team - 1];
+  }
+
+  // Replaces the trail of 'team' (e.g when restoring a saved game).
+  void assign(int team, const TrailSegment* segments, int count)
+  {
+    trails[team - 1].assign(segments, segments + count);
+    unchanged[team - 1] = 0;
+  }
+
+  // For rollbacks: restore() puts back the trail of 'team' as it was at the
+  // last call to markUnchanged(), given a copy of it. Only the segments
+  // changed since are copied back.
+  void markUnchanged();
+  void restore(int team, const TrailSegment* segments, int count);
+
+private:
+  Vec2 cellOf(TrailSegment const& s, int k) const;
+  bool covers(TrailSegment const& s, Vec2 pos) const;
+  void clip(TrailSegment const& s, Vec2 rectPos, Vec2 rectSize, std::vector<TrailSegment>& out) const;
+
+  // The rectangles crossing each band, in their order.
+  struct BandIndex
+  {
+    std::vector<int> start; // per band, and one past the last
+    std::vector<int> items;
+  };
+
+  void indexBands(Board::Rect const* rects, int count, bool rows, BandIndex& index) const;
+
+  const int width, height;
+  std::vector<TrailSegment> trails[MAX_PLAYERS];
+  int unchanged[MAX_PLAYERS] {}; // leading segments untouched since markUnchanged()
+  std::vector<TrailSegment> scratch;
+  std::vector<TrailSegment> pieces, clipped;
+  BandIndex rowBands, columnBands;
+};
+